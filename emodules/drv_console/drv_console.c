@@ -10,12 +10,15 @@ volatile uint8_t* uart16550;
 // (e.g. 32 bit registers instead of 8 bit registers)
 uintptr_t uart16550_reg_shift;
 uintptr_t uart16550_clock = 3686400;   // a "common" base clock
+// bytes one THRE wait may write, 1 on parts without a working FIFO
+uintptr_t uart16550_fifo_depth = 1;
 
 #define UART_REG_QUEUE     0    // rx/tx fifo data
 #define UART_REG_DLL       0    // divisor latch (LSB)
 #define UART_REG_IER       1    // interrupt enable register
 #define UART_REG_DLM       1    // divisor latch (MSB) 
 #define UART_REG_FCR       2    // fifo control register
+#define UART_REG_IIR       2    // interrupt identification register (read)
 #define UART_REG_LCR       3    // line control register
 #define UART_REG_MCR       4    // modem control register
 #define UART_REG_LSR       5    // line status register
@@ -23,6 +26,8 @@ uintptr_t uart16550_clock = 3686400;   // a "common" base clock
 #define UART_REG_SCR       7    // scratch register
 #define UART_REG_STATUS_RX 0x01
 #define UART_REG_STATUS_TX 0x20
+#define UART_FIFO_DEPTH    16   // bytes THRE guarantees room for
+#define UART_IIR_FIFO      0xC0 // both set once a 16550A FIFO is enabled
 
 
 // We cannot use the word DEFAULT for a parameter that cannot be overridden due to -Werror
@@ -40,6 +45,18 @@ int uart16550_putchar(uint8_t ch)
   return 0;
 }
 
+// THRE means the whole TX FIFO is empty, so fill it before polling again
+int uart16550_write(const uint8_t* buf, uintptr_t len)
+{
+  uintptr_t i = 0, n;
+  while (i < len) {
+    while ((uart16550[UART_REG_LSR << uart16550_reg_shift] & UART_REG_STATUS_TX) == 0);
+    for (n = 0; n < uart16550_fifo_depth && i < len; n++, i++)
+      uart16550[UART_REG_QUEUE << uart16550_reg_shift] = buf[i];
+  }
+  return len;
+}
+
 int uart16550_getchar(uint8_t* ch)
 {
   while ((uart16550[UART_REG_LSR << uart16550_reg_shift] & UART_REG_STATUS_RX) == 0);
@@ -70,6 +87,12 @@ int uart16550_init(uintptr_t reg_addr)
     // uart16550[UART_REG_DLM << uart16550_reg_shift] = (uint8_t)(divisor >> 8);     //     (hi byte)
     // uart16550[UART_REG_LCR << uart16550_reg_shift] = 0x03;                // 8 bits, no parity, one stop bit
     // uart16550[UART_REG_FCR << uart16550_reg_shift] = 0xC7;                // Enable FIFO, clear them, with 14-byte threshold
+    // Enable the FIFO without clearing it, the host may still have bytes queued
+    uart16550[UART_REG_FCR << uart16550_reg_shift] = 0x01;
+    if ((uart16550[UART_REG_IIR << uart16550_reg_shift] & UART_IIR_FIFO) == UART_IIR_FIFO)
+      uart16550_fifo_depth = UART_FIFO_DEPTH;
+    else
+      uart16550_fifo_depth = 1;
     return 0;
 }
 
@@ -87,6 +110,8 @@ uintptr_t uart16550_cmd_handler(uintptr_t cmd, uintptr_t arg0, uintptr_t arg1, u
     return uart16550_putchar((uint8_t)(arg0 & 0xff));
   case CONSOLE_CMD_GET:
     return uart16550_getchar((uint8_t *)arg0);
+  case CONSOLE_CMD_WRITE:
+    return uart16550_write((const uint8_t *)arg0, arg1);
   case CONSOLE_CMD_DESTORY:
     return uart16550_destroy();
   default:
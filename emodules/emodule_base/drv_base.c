@@ -9,6 +9,7 @@
 	(usr_sp) -= 8;    \
 	*(uintptr_t *)(usr_sp) = val;
 uintptr_t enclave_id;
+uintptr_t enclave_asid;
 drv_ctrl_t *peri_reg_list[MAX_DRV] = { 0 };
 drv_initer drv_init_list[MAX_DRV];
 drv_addr_t *drv_addr_list;
@@ -17,4 +17,5 @@
 #define SIE_STIE (1 << STIE_SHIFT)
 
 extern uintptr_t enclave_id;
+extern uintptr_t enclave_asid;
 #endif
\ No newline at end of file
@@ -22,26 +22,48 @@ uintptr_t elf_load(uintptr_t pt_root, uintptr_t elf_addr, char id,
 	Elf64_Phdr *phdr_arr = (Elf64_Phdr *)(elf_addr + ehdr->e_phoff);
 	//printd("there are %d program header\n", ehdr->e_phnum);
 	Elf64_Phdr phdr;
-	uintptr_t n_pages;
+	uintptr_t n_pages, file_end, mem_end, attr, pa;
+	*prog_brk = 0;
 	for (int i = 0; i < ehdr->e_phnum; i++) {
 		phdr = phdr_arr[i];
 		switch (phdr.p_type) {
 		case PT_LOAD: {
-			n_pages = (PAGE_UP(phdr.p_filesz) >> EPAGE_SHIFT) + 1;
-			//printd("mapping %d page from %x to %x\n", n_pages, PAGE_DOWN(phdr.p_vaddr), PAGE_DOWN(elf_addr + phdr.p_offset));
-			map_page((pte *)pt_root, PAGE_DOWN(phdr.p_vaddr),
-				 PAGE_DOWN(elf_addr + phdr.p_offset), n_pages,
-				 PTE_U | __pt2pte(phdr.p_flags));
-			if ((n_pages << EPAGE_SHIFT) < phdr.p_memsz) {
-				n_pages =
-					PAGE_UP(phdr.p_memsz - phdr.p_filesz) >>
-					EPAGE_SHIFT;
-				alloc_page(
-					(pte *)pt_root,
-					PAGE_DOWN(phdr.p_vaddr + phdr.p_filesz),
-					n_pages, PTE_U | __pt2pte(phdr.p_flags),
-					id);
+			attr	 = PTE_U | __pt2pte(phdr.p_flags);
+			file_end = phdr.p_vaddr + phdr.p_filesz;
+			mem_end	 = PAGE_UP(phdr.p_vaddr + phdr.p_memsz);
+			if (mem_end > *prog_brk)
+				*prog_brk = mem_end;
+			if (phdr.p_memsz <= phdr.p_filesz) {
+				n_pages = (PAGE_UP(phdr.p_filesz) >> EPAGE_SHIFT) + 1;
+				//printd("mapping %d page from %x to %x\n", n_pages, PAGE_DOWN(phdr.p_vaddr), PAGE_DOWN(elf_addr + phdr.p_offset));
+				if (map_page((pte *)pt_root,
+					     PAGE_DOWN(phdr.p_vaddr),
+					     PAGE_DOWN(elf_addr + phdr.p_offset),
+					     n_pages, attr))
+					return EBI_ERROR;
+				break;
 			}
+			/* Whole pages of file data are used in place */
+			n_pages = (PAGE_DOWN(file_end) - PAGE_DOWN(phdr.p_vaddr)) >>
+				  EPAGE_SHIFT;
+			if (map_page((pte *)pt_root, PAGE_DOWN(phdr.p_vaddr),
+				     PAGE_DOWN(elf_addr + phdr.p_offset), n_pages,
+				     attr))
+				return EBI_ERROR;
+			/* The page shared by data and bss gets a zeroed copy */
+			if (file_end & (EPAGE_SIZE - 1)) {
+				pa = alloc_page((pte *)pt_root,
+						PAGE_DOWN(file_end), 1, attr, id);
+				if (!pa)
+					return EBI_ERROR;
+				memcpy((void *)(pa + va_pa_offset()),
+				       (void *)(elf_addr + phdr.p_offset +
+						PAGE_DOWN(file_end) -
+						phdr.p_vaddr),
+				       file_end & (EPAGE_SIZE - 1));
+			}
+			/* The rest of bss is backed on first touch */
+			vma_add(PAGE_UP(file_end), mem_end, attr);
 			break;
 		}
 		default: {
@@ -49,7 +71,6 @@ uintptr_t elf_load(uintptr_t pt_root, uintptr_t elf_addr, char id,
 		}
 		}
 	}
-	*prog_brk = PAGE_DOWN(phdr.p_paddr) + PAGE_UP(n_pages << EPAGE_SHIFT);
 
 	// Elf64_Shdr *shdr_arr = (Elf64_Shdr *)(elf_addr + ehdr->e_shoff);
 	// //printd("there are %d segments\n", ehdr->e_shnum);
@@ -5,6 +5,8 @@
 #include "drv_mem.h"
 #endif
 #include "drv_util.h"
+#include "mm/drv_page_pool.h"
+#include "mm/vm_area.h"
 #include "enclave.h"
 #define EM_RISCV 243
 #define ELFCLASS64 2
@@ -4,6 +4,12 @@
 #include "drv_util.h"
 #include "drv_syscall.h"
 #include "drv_base.h"
+#include "drv_ring.h"
+#include "mm/drv_page_pool.h"
+#include "mm/page_table.h"
+#include "mm/vm_area.h"
+
+extern uintptr_t pt_root;
 
 void handle_interrupt(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 		      uintptr_t stval)
@@ -28,27 +34,31 @@ void handle_interrupt(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 	}
 }
 
-void handle_exception(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
-		      uintptr_t stval)
+/*
+ * End the enclave for good. Exit does not come back when it works, and
+ * whatever failed must never be carried on with if it does not.
+ */
+void enclave_abort(void)
 {
-	printd("handle exception %d 0x%llx  0x%llx!\n", scause, sepc, stval);
-	// SBI_CALL(EBI_EXIT, 0, 0, 0);
-	SBI_CALL5(SBI_EXT_EBI, 0, 0, 0, EBI_EXIT);
+	console_flush();
+	while (1)
+		SBI_CALL5(SBI_EXT_EBI, enclave_id, 0, 0, EBI_EXIT);
 }
 
-void handle_syscall(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
-		    uintptr_t stval)
+/* An unhandled fault ends the enclave */
+static void __attribute__((noreturn))
+handle_exception(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
+		 uintptr_t stval)
 {
-	uintptr_t sstatus = read_csr(sstatus);
-	sstatus |= SSTATUS_SUM;
-	write_csr(sstatus, sstatus);
-
-	if (scause != CAUSE_USER_ECALL) {
-		handle_exception(regs, scause, sepc, stval);
-	}
+	printd("handle exception %d 0x%llx  0x%llx!\n", scause, sepc, stval);
+	enclave_abort();
+}
 
-	uintptr_t which = regs[A7_INDEX], arg_0 = regs[A0_INDEX],
-		  arg_1 = regs[A1_INDEX], retval = 0;
+/* Syscall table shared by the user payload's ecalls and the host ring */
+uintptr_t dispatch_syscall(uintptr_t which, uintptr_t arg_0, uintptr_t arg_1,
+			   uintptr_t arg_2, uintptr_t arg_3)
+{
+	uintptr_t retval = 0;
 
 	switch (which) {
 	case SYS_fstat:
@@ -63,13 +73,27 @@ void handle_syscall(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 	case SYS_brk:
 		retval = ebi_brk(arg_0);
 		break;
+	case SYS_mmap:
+		retval = ebi_mmap(arg_0, arg_1, arg_2, arg_3);
+		break;
+	case SYS_munmap:
+		retval = ebi_munmap(arg_0, arg_1);
+		break;
 	case SYS_gettimeofday:
 		retval = ebi_gettimeofday((struct timeval *)arg_0,
 					  (struct timezone *)arg_1);
 		break;
 	case SYS_exit:
-		// SBI_CALL(EBI_EXIT, enclave_id, arg_0, 0);
-		SBI_CALL5(SBI_EXT_EBI, enclave_id, 0, 0, EBI_EXIT);
+		console_flush();
+		SBI_CALL5(SBI_EXT_EBI, enclave_id, arg_0, 0, EBI_EXIT);
+		break;
+	case EBI_PAUSE:
+		/* Back to the host with arg_0, returns what resume passes in */
+		console_flush();
+		retval = SBI_CALL5(SBI_EXT_EBI, enclave_id, arg_0, 0, EBI_PAUSE);
+		break;
+	case EBI_SHARE:
+		retval = ebi_share(arg_0);
 		break;
 	case EBI_GOTO:
 		//TODO SBI_CALL -> SBI_CALL5
@@ -77,9 +101,61 @@ void handle_syscall(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 		break;
 	default:
 		printd("syscall %d unimplemented!\n", which);
+		console_flush();
 		SBI_CALL5(SBI_EXT_EBI, enclave_id, 0, 0, EBI_EXIT);
 		break;
 	}
+	return retval;
+}
+
+/*
+ * First touch of a demand-zero page, from the payload or from the base
+ * module working on user memory. Returns 1 once the page is mapped, 0 if
+ * the fault is not one of these or no page can be had, which ends the
+ * enclave in handle_exception().
+ */
+static int handle_page_fault(uintptr_t stval)
+{
+	uintptr_t va   = PAGE_DOWN(stval);
+	vm_area_t *vma = vma_find(stval);
+
+	/* Mapped pages that fault are not ours to fix */
+	if (!vma || get_pa(va) || !spa_avail(USR))
+		return 0;
+	if (!alloc_page((pte *)pt_root, va, 1, vma->attr, USR))
+		return 0;
+	flush_tlb_page(va, enclave_asid);
+	return 1;
+}
+
+void handle_syscall(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
+		    uintptr_t stval)
+{
+	/* Retry the faulting instruction, wherever it came from */
+	if ((scause == CAUSE_FETCH_PAGE_FAULT ||
+	     scause == CAUSE_LOAD_PAGE_FAULT ||
+	     scause == CAUSE_STORE_PAGE_FAULT) &&
+	    handle_page_fault(stval))
+		return;
+
+	uintptr_t sstatus = read_csr(sstatus);
+	sstatus |= SSTATUS_SUM;
+	write_csr(sstatus, sstatus);
+
+	if (scause != CAUSE_USER_ECALL) {
+		handle_exception(regs, scause, sepc, stval);
+	}
+
+	uintptr_t which = regs[A7_INDEX], arg_0 = regs[A0_INDEX],
+		  arg_1 = regs[A1_INDEX], arg_2 = regs[A2_INDEX],
+		  arg_3 = regs[A3_INDEX], retval = 0;
+
+	if (which == EBI_RING)
+		/* Switchless mode, returns once the host stops the ring */
+		retval = ring_serve();
+	else
+		retval = dispatch_syscall(which, arg_0, arg_1, arg_2, arg_3);
+
 	write_csr(sepc, sepc + 4);
 	sstatus = sstatus &
 		  ~(SSTATUS_SPP | SSTATUS_UIE | SSTATUS_UPIE | SSTATUS_SUM);
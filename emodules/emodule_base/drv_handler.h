@@ -4,9 +4,13 @@
 #include "enclave.h"
 void handle_interrupt(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 		      uintptr_t stval);
+uintptr_t dispatch_syscall(uintptr_t which, uintptr_t arg_0, uintptr_t arg_1,
+			   uintptr_t arg_2, uintptr_t arg_3);
 void handle_syscall(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 		    uintptr_t stval);
 
+void __attribute__((noreturn)) enclave_abort(void);
+
 void unimplemented_exception(uintptr_t *regs, uintptr_t scause, uintptr_t sepc,
 			     uintptr_t stval);
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "drv_list.h"
+#include "drv_handler.h"
 #include "mm/drv_page_pool.h"
 #include "mm/page_table.h"
 #include "../drv_console/drv_console.h"
@@ -36,6 +37,8 @@ drv_ctrl_t* init_console_driver() {
     printd("reg_addr:%x, reg_size: %x\n", console_ctrl->reg_addr, console_ctrl->reg_size);
     
     console_va = ioremap((pte *)pt_root, console_ctrl->reg_addr, console_ctrl->reg_size);
+    if (!console_va)
+        enclave_abort();
     // console_va = ioremap((pte*)pt_root,console_ctrl->reg_addr,1024);
     // console_va = 0xd0000000;
     // uintptr_t entry = (uintptr_t) *get_pte((pte*)pt_root,console_va,0);
@@ -3,13 +3,21 @@
 #endif
 #include "drv_base.h"
 #include "drv_elf.h"
+#include "drv_handler.h"
 #include "drv_list.h"
+#include "drv_ring.h"
 #include "mm/drv_page_pool.h"
 #include "mm/page_table.h"
+#include "mm/vm_area.h"
 #include "drv_util.h"
 /* Each Eapp has their own program break */
 uintptr_t prog_brk;
 uintptr_t pt_root;
+/* Region sizes chosen by the host at create time */
+uintptr_t usr_mem_size;
+uintptr_t drv_mem_size;
+/* Size of the host window at EUSR_SHARE_VA, 0 if there is none */
+uintptr_t share_size;
 // uintptr_t drv_start_va;
 
 // pte* get_pte(pte* root, uintptr_t va, char alloc)
@@ -90,13 +98,24 @@ uintptr_t pt_root;
 	})
 #define __pa(x) get_pa(x + EDRV_VA_PA_OFFSET)
 
+/* Without all of its mappings the enclave cannot run, give up on it */
+static void __attribute__((noreturn)) init_mem_fail(const char *what)
+{
+    printd("[init_mem] cannot map %s\n", what);
+    enclave_abort();
+}
+
 /* Initialize memory for driver, including stack, heap, page table */
-void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t drv_list[MAX_DRV], uintptr_t argc, uintptr_t argv)
+void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t drv_list[MAX_DRV], uintptr_t argc, uintptr_t argv, ebi_boot_info_t *boot_info)
 {
     printd("[init_mem] %s %x\n", argv, argc);
     printd("[init_mem] id = %d\n", id);
     printd("[init_mem] mem_start = 0x%lx\n", mem_start);
     enclave_id = id;
+    usr_mem_size = boot_info->usr_mem_size;
+    drv_mem_size = boot_info->drv_mem_size;
+    enclave_asid = boot_info->asid;
+    printd("[init_mem] usr_mem_size = 0x%lx, drv_mem_size = 0x%lx\n", usr_mem_size, drv_mem_size);
     // printd("mem start: 0x%x\n enclave id: 0x%x\n usr size: 0x%x\n", mem_start,
     // id, usr_size);
     /* Give all spare memory to stack allocator, one for drivers, one for user
@@ -126,8 +145,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     drv_addr_list = (void*)(EDRV_VA_PA_OFFSET + (void*) drv_addr_list);
     
     printd("\033[1;33mdrv_addr_list=%p at %p, drv_list=%p\n\033[0m",drv_addr_list, &drv_addr_list, drv_list);
-    uintptr_t base_avail_start = PAGE_UP((uintptr_t)drv_list + (uintptr_t)(64 * sizeof(drv_addr_t)));
-    uintptr_t base_avail_end = mem_start + EDRV_MEM_SIZE + EUSR_MEM_SIZE;
+    /* Driver list, boot info and user parameters are followed by free memory */
+    uintptr_t base_avail_start = PAGE_UP(boot_info->drv_free_start);
+    uintptr_t base_avail_end = mem_start + usr_mem_size + drv_mem_size;
     uintptr_t base_avail_size = PAGE_DOWN(base_avail_end - base_avail_start);
     printd("[init_mem] base_avail_start = 0x%x, base_avail_end = 0x%x\n", base_avail_start, base_avail_end);
     printd("[init_mem] base_avail_size = %x\n", base_avail_size);
@@ -142,32 +162,55 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
 
     /* More delicate allocation require ELF */
     uintptr_t usr_avail_start = PAGE_UP(mem_start + usr_size);
-    uintptr_t usr_avail_size = EUSR_MEM_SIZE - usr_size;
+    uintptr_t usr_avail_size = mem_start + usr_mem_size - usr_avail_start;
     spa_init(usr_avail_start, PAGE_DOWN(usr_avail_size), USR);
     printd("initializing user spa: 0x%x, size: 0x%x\n", usr_avail_start,
         usr_avail_size);
     printd("user spa initialize done\n");
 
     all_zero();
+    page_table_enable_napot(boot_info->flags & EBI_BOOT_SVNAPOT);
     // pt_root = spa_get_zero(DRV);
     pt_root = get_page_table_root();
     printd("\033[1;33m[init_mem] root: 0x%x\n\033[0m", pt_root);
     /* Load ELF running inside enclave */
     uintptr_t usr_pc = elf_load(pt_root, mem_start, USR, &prog_brk);
+    if (usr_pc == EBI_ERROR)
+        init_mem_fail("payload");
     
-    if (drv_list != 0) {
-    // if (drv_list != 0 && drv_list[cnt].drv_start != 0) {
+    if (drv_list != 0 && cnt != 0) {
         uintptr_t drv_pa_start = PAGE_DOWN(drv_list[0].drv_start - EDRV_VA_PA_OFFSET);
-        uintptr_t drv_pa_end = PAGE_UP(((uintptr_t)drv_list) + 64 * sizeof(drv_addr_t));
+        /* drivers, driver list, boot info and user parameters */
+        uintptr_t drv_pa_end = PAGE_UP(boot_info->drv_free_start);
         printd("[init_mem] drv_pa_end = 0x%x drv_pa_start = 0x%x\n", drv_pa_end, drv_pa_start);
-        map_page((pte*)pt_root, PAGE_DOWN(drv_list[0].drv_start), drv_pa_start, (PAGE_UP(drv_pa_end - drv_pa_start)>>EPAGE_SHIFT), PTE_V | PTE_R | PTE_X);
+        if (map_page((pte*)pt_root, PAGE_DOWN(drv_list[0].drv_start), drv_pa_start, (PAGE_UP(drv_pa_end - drv_pa_start)>>EPAGE_SHIFT), PTE_V | PTE_R | PTE_X))
+            init_mem_fail("drivers");
         printd("\033[1;33mdrv: 0x%x - 0x%x -> 0x%x\n\033[0m", drv_pa_start,
         drv_pa_end, __pa(drv_pa_start));
     }
+    /* Host call ring, attached by the host before the first enter */
+    if (boot_info->ring_size) {
+        if (map_page((pte*)pt_root, EDRV_RING_VA, boot_info->ring_pa,
+            boot_info->ring_size >> EPAGE_SHIFT, PTE_V | PTE_W | PTE_R))
+            init_mem_fail("ring");
+        ring_init(EDRV_RING_VA, boot_info->ring_size);
+        printd("ring: 0x%x - 0x%x\n", boot_info->ring_pa,
+            boot_info->ring_pa + boot_info->ring_size);
+    }
+    /* Host window, user accessible so the payload works on it in place */
+    if (boot_info->share_size) {
+        share_size = boot_info->share_size;
+        if (map_page((pte*)pt_root, EUSR_SHARE_VA, boot_info->share_pa,
+            share_size >> EPAGE_SHIFT, PTE_V | PTE_W | PTE_R | PTE_U))
+            init_mem_fail("share window");
+        printd("share: 0x%x - 0x%x\n", boot_info->share_pa,
+            boot_info->share_pa + share_size);
+    }
     /* base driver remaining mem */
     /* thus easier manupilating satp */
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + usr_avail_start, usr_avail_start,
-        PAGE_DOWN(usr_avail_size) >> EPAGE_SHIFT, PTE_V | PTE_W | PTE_R);
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + usr_avail_start, usr_avail_start,
+        PAGE_DOWN(usr_avail_size) >> EPAGE_SHIFT, PTE_V | PTE_W | PTE_R))
+        init_mem_fail("usr.remain");
     printd("usr.remain: 0x%x - 0x%x -> 0x%x\n", usr_avail_start,
         usr_avail_start + PAGE_DOWN(usr_avail_size), __pa(usr_avail_start));
 
@@ -176,8 +219,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     // printd("we need %d pages\n", n_user_stack_pages);
     uintptr_t usr_sp = prog_brk + EUSR_STACK_SIZE * EUSR_HEAP_STACK_RATIO;
     // printd("user stack: 0x%x - 0x%x -> 0x%x\n", usr_sp, usr_sp + EUSR_STACK_SIZE);
-    alloc_page((pte*)pt_root, usr_sp, n_user_stack_pages,
-        PTE_V | PTE_W | PTE_R | PTE_U, USR);
+    /* backed on first touch like bss and heap */
+    vma_add(usr_sp, usr_sp + (n_user_stack_pages << EPAGE_SHIFT),
+        PTE_V | PTE_W | PTE_R | PTE_U);
     usr_sp += EUSR_STACK_SIZE;
 
     /* Try map pages */
@@ -187,8 +231,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     uintptr_t text_end = (uintptr_t)&_text_end;
     uintptr_t text_size = text_end - text_start;
     size_t n_base_text_pages = (PAGE_UP(text_size)) >> EPAGE_SHIFT;
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + text_start, text_start,
-        n_base_text_pages, PTE_V | PTE_X | PTE_R);
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + text_start, text_start,
+        n_base_text_pages, PTE_V | PTE_X | PTE_R))
+        init_mem_fail(".text");
     printd(".text: 0x%x - 0x%x -> 0x%x\n", text_start, text_end, __pa(text_start));
 
     /* page_table */
@@ -197,8 +242,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     uintptr_t page_table_end = (uintptr_t)&_page_table_end;
     uintptr_t init_data_size = page_table_end - page_table_start;
     size_t n_base_init_data_pages = (PAGE_UP(init_data_size)) >> EPAGE_SHIFT;
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + page_table_start, page_table_start,
-        n_base_init_data_pages, PTE_V | PTE_W | PTE_R);
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + page_table_start, page_table_start,
+        n_base_init_data_pages, PTE_V | PTE_W | PTE_R))
+        init_mem_fail("page_table");
     printd("page_table: 0x%x - 0x%x -> 0x%x\n", page_table_start, page_table_end, __pa(page_table_start));
 
     /* base driver .init.data section */
@@ -227,8 +273,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     uintptr_t rodata_end = (uintptr_t)&_rodata_end;
     uintptr_t rodata_size = rodata_end - rodata_start;
     size_t n_base_rodata_pages = (PAGE_UP(rodata_size)) >> EPAGE_SHIFT;
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + rodata_start, rodata_start,
-        n_base_rodata_pages, PTE_V | PTE_R);
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + rodata_start, rodata_start,
+        n_base_rodata_pages, PTE_V | PTE_R))
+        init_mem_fail(".rodata");
     printd(".rodata: 0x%x - 0x%x -> 0x%x\n", rodata_start, rodata_end, __pa(rodata_start));
 
     /* base driver .bss section */
@@ -237,8 +284,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     uintptr_t bss_end = (uintptr_t)&_bss_end;
     uintptr_t bss_size = bss_end - bss_start;
     size_t n_base_bss_pages = (PAGE_UP(bss_size)) >> EPAGE_SHIFT;
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + bss_start, bss_start,
-        n_base_bss_pages, PTE_V | PTE_W | PTE_R);
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + bss_start, bss_start,
+        n_base_bss_pages, PTE_V | PTE_W | PTE_R))
+        init_mem_fail(".bss");
     printd(".bss: 0x%x - 0x%x -> 0x%x\n", bss_start, bss_end, __pa(bss_start));
 
     volatile uintptr_t a7;
@@ -248,9 +296,10 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     /* base driver remaining mem */
     /* thus easier manupilating satp */
 
-    map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + base_avail_start,
+    if (map_page((pte*)pt_root, EDRV_VA_PA_OFFSET + base_avail_start,
         base_avail_start, PAGE_DOWN(base_avail_size) >> EPAGE_SHIFT,
-        PTE_V | PTE_W | PTE_R);
+        PTE_V | PTE_W | PTE_R))
+        init_mem_fail("drv.remain");
     printd("drv.remain: 0x%x - 0x%x -> 0x%x\n", base_avail_start,
     base_avail_start+PAGE_DOWN(base_avail_size), __pa(base_avail_start));
 
@@ -258,8 +307,9 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     size_t n_base_stack_pages = (PAGE_UP(EDRV_STACK_SIZE)) >> EPAGE_SHIFT;
     printd("drv stack uses %d pages\n", n_base_stack_pages);
     uintptr_t drv_sp = EDRV_VA_START + EDRV_MEM_SIZE - EDRV_STACK_SIZE;
-    alloc_page((pte*)pt_root, drv_sp, n_base_stack_pages, PTE_V | PTE_W | PTE_R,
-        DRV);
+    if (!alloc_page((pte*)pt_root, drv_sp, n_base_stack_pages, PTE_V | PTE_W | PTE_R,
+        DRV))
+        init_mem_fail("stack");
     drv_sp += EDRV_STACK_SIZE;
 
     printd("sp: 0x%llx\nsatp: 0x%llx\n", drv_sp, pt_root);
@@ -267,6 +317,7 @@ void init_mem(uintptr_t id, uintptr_t mem_start, uintptr_t usr_size, drv_addr_t
     printd("wtf!!!!!\n");
     uintptr_t satp = pt_root >> EPAGE_SHIFT;
     satp |= (uintptr_t)SATP_MODE_SV39 << SATP_MODE_SHIFT;
+    satp |= enclave_asid << SATP_ASID_SHIFT;
 
     // printd("[init_mem] drv_list_addr: 0x%p at 0x%p\n",drv_addr_list, &drv_addr_list);
     // enclave_id = 114514;
@@ -12,6 +12,7 @@
 
 // /* Based on 64 bits Sv39 Page */
 #define SATP_MODE_SHIFT      60
+#define SATP_ASID_SHIFT      44
 // #define EPAGE_SHIFT          12
 // #define EPAGE_SIZE           (1 << EPAGE_SHIFT)
 // #define EMEGA_PAGE_SHIFT     21
@@ -56,6 +57,8 @@
 #ifndef __ASSEMBLER__
 extern uintptr_t pt_root;
 extern uintptr_t prog_brk;
+extern uintptr_t usr_mem_size;
+extern uintptr_t drv_mem_size;
 #endif
 
 // pte *get_pte(pte *root, uintptr_t va, char alloc);
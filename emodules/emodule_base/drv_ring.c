@@ -0,0 +1,74 @@
+#include "drv_ring.h"
+#include "drv_base.h"
+#include "drv_handler.h"
+#include "drv_util.h"
+
+static ebi_ring_t *ring;
+static uintptr_t ring_max_slots;
+
+void ring_init(uintptr_t va, uintptr_t size)
+{
+	ring	       = (ebi_ring_t *)va;
+	ring_max_slots = (size - sizeof(ebi_ring_t)) / sizeof(ebi_ring_slot_t);
+	printd("[ring_init] ring @ 0x%lx, %d slots at most\n", va,
+	       ring_max_slots);
+}
+
+/*
+ * Nothing posted for a while: wait for the host's IPI. sstatus.SIE stays
+ * clear, so the pending soft interrupt only wakes wfi and never traps.
+ * SSIP is shared with the host's own IPIs, so it is only cleared when the
+ * doorbell shows the host rang, and with another IPI already pending the
+ * worker keeps polling rather than sleep and drop it.
+ */
+static void ring_sleep(ebi_ring_slot_t *slot)
+{
+	uintptr_t bell = ring->doorbell;
+
+	ring->sleeping = 1;
+	__sync_synchronize();
+	if (slot->state != EBI_RING_REQ && !ring->stop &&
+	    !(read_csr(sip) & SIP_SSIP)) {
+		set_csr(sie, SIE_SSIE);
+		asm volatile("wfi");
+		clear_csr(sie, SIE_SSIE);
+		if (ring->doorbell != bell)
+			clear_csr(sip, SIP_SSIP);
+	}
+	ring->sleeping = 0;
+}
+
+/* Serve host calls until the host sets stop, returns how many were served */
+uintptr_t ring_serve(void)
+{
+	uintptr_t nslots, tail = 0, spin = 0;
+	ebi_ring_slot_t *slot;
+
+	if (!ring)
+		return -1;
+	nslots = ring->nslots;
+	if (!nslots || nslots > ring_max_slots)
+		return -1;
+
+	ring->tail = 0;
+	while (!ring->stop) {
+		slot = &ring->slots[tail % nslots];
+		if (slot->state != EBI_RING_REQ) {
+			if (++spin >= EBI_RING_SPIN) {
+				ring_sleep(slot);
+				spin = 0;
+			}
+			continue;
+		}
+		/* Arguments were written before the state */
+		__sync_synchronize();
+		slot->ret = dispatch_syscall(slot->which, slot->arg_0,
+					     slot->arg_1, slot->arg_2,
+					     slot->arg_3);
+		__sync_synchronize();
+		slot->state = EBI_RING_DONE;
+		ring->tail  = ++tail;
+		spin	    = 0;
+	}
+	return tail;
+}
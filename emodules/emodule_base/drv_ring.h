@@ -0,0 +1,57 @@
+#pragma once
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#include "enclave.h"
+
+/*
+ * Switchless host calls. The host attaches a page aligned buffer of its
+ * own memory with EBI_RING before the first enter, and emodule_base maps
+ * it at EDRV_RING_VA. Once the payload makes the EBI_RING syscall, its
+ * hart serves the ring until the host sets stop:
+ *
+ *   host:    fill which and args of a FREE slot, fence, state = REQ, then
+ *            if sleeping is set, bump doorbell, fence and send an IPI to
+ *            the enclave's hart
+ *   enclave: run the slot through the syscall table, write ret, fence,
+ *            state = DONE
+ *   host:    read ret, state = FREE
+ *
+ * Slots are served in order, so the host fills them in order too. Pointer
+ * arguments are enclave addresses: data placed in the ring pages after
+ * the slots is seen at EDRV_RING_VA plus its offset in the ring.
+ */
+
+#define EBI_RING_FREE 0
+#define EBI_RING_REQ  1
+#define EBI_RING_DONE 2
+
+/* Idle polls before the worker sleeps until the next IPI */
+#define EBI_RING_SPIN 4096
+
+typedef struct {
+	volatile uintptr_t state;
+	uintptr_t which;
+	uintptr_t arg_0;
+	uintptr_t arg_1;
+	uintptr_t arg_2;
+	uintptr_t arg_3;
+	uintptr_t ret;
+	uintptr_t __pad;
+} ebi_ring_slot_t;
+
+typedef struct {
+	/* Set by the host before the ring is served */
+	uintptr_t nslots;
+	volatile uintptr_t stop;
+	/* Bumped by the host before each wake up IPI */
+	volatile uintptr_t doorbell;
+	/* Set by the enclave */
+	volatile uintptr_t tail;
+	volatile uintptr_t sleeping;
+	uintptr_t __pad[3];
+	ebi_ring_slot_t slots[];
+} ebi_ring_t;
+
+void ring_init(uintptr_t va, uintptr_t size);
+uintptr_t ring_serve(void);
+#endif
@@ -4,6 +4,8 @@
 #include "drv_mem.h"
 #endif
 #include "mm/drv_page_pool.h"
+#include "mm/page_table.h"
+#include "mm/vm_area.h"
 #include "drv_base.h"
 #include "drv_list.h"
 #include "../drv_console/drv_console.h"
@@ -11,6 +13,7 @@
 extern uintptr_t prog_brk;
 extern uintptr_t pt_root;
 extern drv_addr_t *drv_addr_list;
+extern uintptr_t share_size;
 int ebi_fstat(uintptr_t fd, uintptr_t sstat)
 {
 	struct stat *stat = (struct stat *)sstat;
@@ -35,35 +38,137 @@ int ebi_brk(uintptr_t addr)
 {
 	if (addr == 0)
 		return prog_brk;
-	if (addr > PAGE_UP(prog_brk)) {
-		uintptr_t n_pages = PAGE_UP(addr - prog_brk) >> EPAGE_SHIFT;
-		uintptr_t pa	  = alloc_page((pte *)pt_root, PAGE_DOWN(addr),
-					       n_pages, PTE_U | PTE_R | PTE_W, USR);
-	}
+	/* Heap pages are backed on first touch */
+	if (addr > prog_brk &&
+	    vma_add(PAGE_DOWN(prog_brk), PAGE_UP(addr), PTE_U | PTE_R | PTE_W))
+		return prog_brk;
 	prog_brk = addr;
-	flush_tlb();
 	return addr;
 }
 
+/*
+ * Anonymous private mappings only, placed in the mmap window. Pages are
+ * backed on first touch like the heap and given back by munmap. Leaves
+ * are always mapped RWX, like the rest of the payload, so prot must ask
+ * for read and write: PROT_NONE guards and read-only mappings fail.
+ */
+uintptr_t ebi_mmap(uintptr_t addr, uintptr_t len, uintptr_t prot,
+		   uintptr_t flags)
+{
+	uintptr_t va, attr = PTE_U | PTE_R | PTE_W | PTE_X;
+
+	if (!len || !(flags & MAP_ANONYMOUS) || (flags & MAP_FIXED))
+		return (uintptr_t)MAP_FAILED;
+	if ((prot & (PROT_READ | PROT_WRITE)) != (PROT_READ | PROT_WRITE))
+		return (uintptr_t)MAP_FAILED;
+	len = PAGE_UP(len);
+
+	va = vma_find_free(EUSR_MMAP_START, EUSR_MMAP_END, len);
+	if (!va || vma_add(va, va + len, attr))
+		return (uintptr_t)MAP_FAILED;
+	return va;
+}
+
+/* Past this many pages one ASID wide fence beats a fence per page */
+#define MUNMAP_FLUSH_PAGES 64
+
+/*
+ * Unmap the demand backed pages of [addr, addr + len) and give them back
+ * to the USR pool. Pages loaded from the payload image are left alone.
+ */
+int ebi_munmap(uintptr_t addr, uintptr_t len)
+{
+	uintptr_t va, pa, end = addr + PAGE_UP(len);
+	uintptr_t run_pa = 0, run_n = 0;
+	int per_page = (PAGE_UP(len) >> EPAGE_SHIFT) <= MUNMAP_FLUSH_PAGES;
+
+	if (!len || (addr & (EPAGE_SIZE - 1)) || end < addr)
+		return -1;
+	for (va = addr; va < end; va += EPAGE_SIZE) {
+		if (!vma_find(va))
+			continue;
+		pa = unmap_page(va);
+		if (!pa)
+			continue;
+		if (per_page)
+			flush_tlb_page(va, enclave_asid);
+		/* Hand physically contiguous pages back as one run */
+		if (run_n && pa == run_pa + (run_n << EPAGE_SHIFT)) {
+			run_n++;
+			continue;
+		}
+		if (run_n)
+			spa_put_n(run_pa + va_pa_offset(), run_n, USR);
+		run_pa = pa;
+		run_n  = 1;
+	}
+	if (run_n)
+		spa_put_n(run_pa + va_pa_offset(), run_n, USR);
+	if (!per_page)
+		flush_tlb_asid(enclave_asid);
+	return vma_remove(addr, end);
+}
+
+/*
+ * Console output is kept in a line buffer and handed to the driver in one
+ * command per line, so the driver can fill the UART FIFO instead of
+ * waiting on it for each byte.
+ */
+#define CONSOLE_BUF_SIZE 256
+/* Timer ticks to wait for another enclave's line before dropping ours */
+#define CONSOLE_FETCH_TIMEOUT 1000000
+static char console_buf[CONSOLE_BUF_SIZE];
+static uintptr_t console_len;
+
+void console_flush(void)
+{
+	cmd_handler console_handler;
+	int id = drv_addr_list[DRV_CONSOLE].id;
+
+	if (!console_len)
+		return;
+	console_handler = (cmd_handler)drv_addr_list[DRV_CONSOLE].drv_start;
+	/*
+	 * The UART is shared with enclaves on other harts, wait for our turn.
+	 * Without it the line is dropped rather than written over theirs.
+	 */
+	if (SBI_CALL5(SBI_EXT_EBI, id, CONSOLE_FETCH_TIMEOUT, 0, EBI_FETCH) ==
+	    EBI_OK) {
+		console_handler(CONSOLE_CMD_WRITE, (uintptr_t)console_buf,
+				console_len, 0);
+		SBI_CALL5(SBI_EXT_EBI, id, 0, 0, EBI_RELEASE);
+	}
+	console_len = 0;
+}
+
 int ebi_write(uintptr_t fd, uintptr_t content)
 {
 	/* stdout */
 	printd("[ebi_write]\n");
-	// SBI_CALL5(SBI_EXT_EBI, enclave_id, 0, 0, EBI_FETCH);
-	cmd_handler console_handler =
-		(cmd_handler)drv_addr_list[DRV_CONSOLE].drv_start;
 	if (fd == 1) {
 		char *str = (char *)content;
 		while (*str) {
-			console_handler(CONSOLE_CMD_PUT, *str, 0, 0);
+			console_buf[console_len++] = *str;
+			if (*str == '\n' || console_len == CONSOLE_BUF_SIZE)
+				console_flush();
 			*str = 0;
 			str++;
 		}
 	}
-	// SBI_CALL5(SBI_EXT_EBI, enclave_id, 0, 0, EBI_RELEASE);
 	return 0;
 }
 
+/*
+ * Where the host's shared window is mapped, 0 if it attached none. Its
+ * size is stored to size_ptr when that is not NULL.
+ */
+uintptr_t ebi_share(uintptr_t size_ptr)
+{
+	if (size_ptr)
+		*(uintptr_t *)size_ptr = share_size;
+	return share_size ? EUSR_SHARE_VA : 0;
+}
+
 int ebi_close(uintptr_t fd)
 {
 	return 0;
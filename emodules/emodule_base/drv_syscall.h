@@ -45,6 +45,7 @@
 #include <sys/stat.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include "enclave.h"
 
 #define EFAULT -1
@@ -52,7 +53,12 @@
 
 int ebi_fstat(uintptr_t fd, uintptr_t sstat);
 int ebi_brk(uintptr_t addr);
+uintptr_t ebi_mmap(uintptr_t addr, uintptr_t len, uintptr_t prot,
+		   uintptr_t flags);
+int ebi_munmap(uintptr_t addr, uintptr_t len);
 int ebi_write(uintptr_t fd, uintptr_t content);
+void console_flush(void);
 int ebi_close(uintptr_t fd);
+uintptr_t ebi_share(uintptr_t size_ptr);
 int ebi_gettimeofday(struct timeval *tv, struct timezone *tz);
 #endif
\ No newline at end of file
@@ -27,6 +27,7 @@
 			     : "+r"(a0)                                  \
 			     : "r"(a1), "r"(a2), "r"(a6), "r"(a7)        \
 			     : "memory");                                \
+		a0;                                                      \
 	})
 
 #ifndef __ASSEMBLER__
@@ -8,9 +8,15 @@
 #define EBI_GOTO    402
 #define EBI_FETCH   403
 #define EBI_RELEASE 404
+#define EBI_PAUSE   405
+#define EBI_RESUME  406
+#define EBI_QUERY   407
+#define EBI_RING    408
+#define EBI_SHARE   409
 
 #define EBI_PUTS    410
 #define EBI_GETS    411
+#define EBI_MEASURE 412
 
 #define EBI_OK      0
 #define EBI_ERROR   -1
@@ -72,6 +78,21 @@
 #define MAX_DRV  64
 #define QUERY_INFO -1
 
+/* Written by the firmware after the driver list, passed in a6 */
+typedef struct {
+  uintptr_t usr_mem_size;
+  uintptr_t drv_mem_size;
+  uintptr_t drv_free_start;
+  uintptr_t asid;
+  uintptr_t ring_pa;
+  uintptr_t ring_size;
+  uintptr_t share_pa;
+  uintptr_t share_size;
+  uintptr_t flags;
+} ebi_boot_info_t;
+
+#define EBI_BOOT_SVNAPOT 0x1 // 64 KiB NAPOT leaves may be used
+
 #define read_csr(reg) ({ unsigned long __tmp; \
   asm volatile ("csrr %0, " #reg : "=r"(__tmp)); \
   __tmp; })
@@ -85,6 +106,17 @@ static inline void flush_tlb()
 {
   asm volatile ("sfence.vma");
 }
+
+/* Only drops this enclave's translations, the host's stay cached */
+static inline void flush_tlb_asid(uintptr_t asid)
+{
+  asm volatile ("sfence.vma zero, %0" :: "r"(asid) : "memory");
+}
+
+static inline void flush_tlb_page(uintptr_t va, uintptr_t asid)
+{
+  asm volatile ("sfence.vma %0, %1" :: "r"(va), "r"(asid) : "memory");
+}
 #endif
 
 #ifndef RISCV_CSR_ENCODING_H
@@ -8,20 +8,28 @@
 /* SPA alway return ACCESSABLE address instead of raw physical address!!!! */
 
 struct pg_list page_pools[NUM_POOL];
+/* Recently freed pages handed out again without touching the list */
+static struct spa_magazine magazines[NUM_POOL];
+/* Set for good once paging is on, it is never turned off again */
+static uintptr_t paging_offset;
 
 uintptr_t va_pa_offset()
 {
-	uintptr_t satp = read_csr(satp);
+	uintptr_t satp;
+
+	if (paging_offset)
+		return paging_offset;
+	satp = read_csr(satp);
 	/* if paging already enabled, add offset */
 	if (satp & ((uintptr_t)SATP_MODE_SV39 << SATP_MODE_SHIFT))
-		return EDRV_VA_PA_OFFSET;
-	return 0;
+		paging_offset = EDRV_VA_PA_OFFSET;
+	return paging_offset;
 }
 
-void __spa_put(uintptr_t addr, struct pg_list *pool)
+static void __spa_put_offset(uintptr_t addr, struct pg_list *pool,
+			     uintptr_t offset)
 {
 	uintptr_t prev;
-	uintptr_t offset = va_pa_offset();
 	addr		 = addr - offset;
 	if (!LIST_EMPTY(pool)) {
 		prev		= pool->tail + offset;
@@ -35,6 +43,11 @@ void __spa_put(uintptr_t addr, struct pg_list *pool)
 	pool->count++;
 }
 
+void __spa_put(uintptr_t addr, struct pg_list *pool)
+{
+	__spa_put_offset(addr, pool, va_pa_offset());
+}
+
 uintptr_t __spa_get(struct pg_list *pool)
 {
 	uintptr_t page;
@@ -50,26 +63,62 @@ uintptr_t __spa_get(struct pg_list *pool)
 	return page;
 }
 
+/* Accessible address of a page, from the magazine when it has one */
+static uintptr_t spa_mag_get(char id)
+{
+	struct spa_magazine *mag = magazines + id;
+	struct pg_list *pool	 = page_pools + id;
+	uintptr_t offset	 = va_pa_offset();
+
+	if (!mag->count) {
+		/* Refill half of it from the list in one go */
+		while (mag->count < SPA_MAG_SIZE / 2 && !LIST_EMPTY(pool))
+			mag->pages[mag->count++] = __spa_get(pool) - offset;
+		if (!mag->count)
+			return -1;
+	}
+	return mag->pages[--mag->count] + offset;
+}
+
+static void spa_mag_put(uintptr_t addr, char id)
+{
+	struct spa_magazine *mag = magazines + id;
+	uintptr_t offset	 = va_pa_offset();
+	unsigned int i;
+
+	if (mag->count == SPA_MAG_SIZE) {
+		/* Spill the older half back to the list */
+		for (i = 0; i < SPA_MAG_SIZE / 2; i++)
+			__spa_put_offset(mag->pages[i] + offset,
+					 page_pools + id, offset);
+		for (i = 0; i < SPA_MAG_SIZE / 2; i++)
+			mag->pages[i] = mag->pages[i + SPA_MAG_SIZE / 2];
+		mag->count = SPA_MAG_SIZE / 2;
+	}
+	mag->pages[mag->count++] = addr - offset;
+}
+
 void spa_init(uintptr_t base, size_t size, char id)
 {
-	uintptr_t cur;
+	uintptr_t cur, offset = va_pa_offset();
 	struct pg_list *pool = page_pools + id;
 	LIST_INIT(pool);
+	(magazines + id)->count = 0;
 	for (cur = base; cur < base + size; cur += EPAGE_SIZE) {
-		__spa_put(cur, pool);
+		__spa_put_offset(cur, pool, offset);
 	}
 }
 void spa_put(uintptr_t addr, char id)
 {
-	__spa_put(addr, page_pools + id);
+	spa_mag_put(addr, id);
 }
 uintptr_t spa_get(char id)
 {
-	return __spa_get(page_pools + id);
+	return spa_mag_get(id);
 }
 uintptr_t spa_get_zero(char id)
 {
-	uintptr_t page = __spa_get(page_pools + id);
+	uintptr_t page = spa_mag_get(id);
 	if (page == -1 && id == DRV)
 		printd("OUT OF PAGE DRV\n");
 	else if (page == -1 && id == USR)
@@ -80,17 +129,106 @@ uintptr_t spa_get_zero(char id)
 
 uintptr_t spa_get_pa(char id)
 {
-	return __spa_get(page_pools + id) - va_pa_offset();
+	return spa_mag_get(id) - va_pa_offset();
 }
 
 uintptr_t spa_get_pa_zero(char id)
 {
-	uintptr_t page = __spa_get(page_pools + id);
+	uintptr_t page = spa_mag_get(id);
 	memset((char *)page, 0, EPAGE_SIZE);
 	return page - va_pa_offset();
 }
 
+/*
+ * Take up to *n pages in one go, as the longest physically contiguous run
+ * at the head of the list. Returns the accessible address of the first
+ * page and sets *n to the run length, or returns 0 with *n = 0 when the
+ * pool is empty. The pages are not zeroed.
+ */
+uintptr_t spa_get_n(char id, size_t *n)
+{
+	struct pg_list *pool = page_pools + id;
+	uintptr_t offset = va_pa_offset(), first = pool->head, last;
+	size_t got;
+
+	if (LIST_EMPTY(pool)) {
+		/* Only the magazine is left */
+		first = spa_mag_get(id);
+		*n    = first == -1 ? 0 : 1;
+		return first == -1 ? 0 : first;
+	}
+	last = first;
+	for (got = 1; got < *n && got < pool->count &&
+		      NEXT_PAGE(last + offset) == last + EPAGE_SIZE;
+	     got++)
+		last += EPAGE_SIZE;
+
+	pool->head = NEXT_PAGE(last + offset);
+	pool->count -= got;
+	*n = got;
+	return first + offset;
+}
+
+/* Give back n physically contiguous pages starting at accessible addr */
+void spa_put_n(uintptr_t addr, size_t n, char id)
+{
+	struct pg_list *pool = page_pools + id;
+	uintptr_t offset     = va_pa_offset();
+
+	if (n == 1) {
+		spa_mag_put(addr, id);
+		return;
+	}
+	while (n--) {
+		__spa_put_offset(addr, pool, offset);
+		addr += EPAGE_SIZE;
+	}
+}
+
+/*
+ * Take n physically contiguous pages starting on an n page boundary, for
+ * a large leaf. Returns their zeroed physical address, or 0 and takes
+ * nothing if the pool has no such run.
+ */
+uintptr_t spa_get_run_pa_zero(char id, size_t n)
+{
+	struct pg_list *pool = page_pools + id;
+	uintptr_t offset = va_pa_offset(), size = n << EPAGE_SHIFT;
+	uintptr_t prev = 0, first = pool->head, last, next;
+	size_t i;
+
+	if (pool->count < n)
+		return 0;
+	while (first) {
+		if (!(first & (size - 1))) {
+			last = first;
+			for (i = 1; i < n && NEXT_PAGE(last + offset) ==
+						     last + EPAGE_SIZE;
+			     i++)
+				last += EPAGE_SIZE;
+			if (i == n)
+				break;
+		}
+		prev  = first;
+		first = NEXT_PAGE(first + offset);
+	}
+	if (!first)
+		return 0;
+
+	next = NEXT_PAGE(last + offset);
+	if (prev)
+		NEXT_PAGE(prev + offset) = next;
+	else
+		pool->head = next;
+	if (pool->tail == last)
+		pool->tail = prev;
+	pool->count -= n;
+
+	memset((char *)(first + offset), 0, size);
+	return first;
+}
+
 uintptr_t spa_avail(char id)
 {
-	return (page_pools + id)->count;
+	return (page_pools + id)->count + (magazines + id)->count;
 }
\ No newline at end of file
@@ -22,12 +22,23 @@ struct pg_list {
 	unsigned int count;
 };
 
+/* Pages kept off the list per pool, as physical addresses */
+#define SPA_MAG_SIZE 16
+
+struct spa_magazine {
+	uintptr_t pages[SPA_MAG_SIZE];
+	unsigned int count;
+};
+
 void spa_init(uintptr_t base, size_t size, char id);
 uintptr_t spa_get(char id);
 uintptr_t spa_get_zero(char id);
 uintptr_t spa_get_pa(char id);
 uintptr_t spa_get_pa_zero(char id);
+uintptr_t spa_get_run_pa_zero(char id, size_t n);
+uintptr_t spa_get_n(char id, size_t *n);
+void spa_put_n(uintptr_t addr, size_t n, char id);
 void spa_put(uintptr_t page, char id);
-unsigned int spa_available(char id);
+uintptr_t spa_avail(char id);
 uintptr_t va_pa_offset();
 #endif
\ No newline at end of file
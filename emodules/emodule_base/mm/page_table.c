@@ -1,17 +1,77 @@
 // #define _DEBUG_LANRANLI
 
 #include <stdint.h>
+#include <string.h>
 #include "page_table.h"
 #include "drv_page_pool.h"
 
 #define PAGE_SIZE 4096
 #ifdef _DEBUG_LANRANLI
 #define printd printf
+#else
+/* Each character is an ecall, far too slow for the demand fault path */
+#define printd(...) do { } while (0)
 #endif
 
 static page_directory page_directory_pool[PAGE_DIR_POOL] __attribute__((section(".page_table")));
 static trie address_trie __attribute__((section(".page_table_trie")));
 
+/* Set by init_mem() when the harts implement Svnapot */
+static int napot_enabled;
+
+void page_table_enable_napot(int enable)
+{
+	napot_enabled = enable;
+}
+
+/* Next unused directory of the pool, 0 once PAGE_DIR_POOL is used up */
+static uint32_t trie_new_dir(trie *t)
+{
+	if (t->cnt + 1 >= PAGE_DIR_POOL) {
+		printd("[page_table] out of page directories, PAGE_DIR_POOL = %d\n",
+		       PAGE_DIR_POOL);
+		return 0;
+	}
+	printd("page cnt:%d\n", t->cnt + 1);
+	return ++t->cnt;
+}
+
+static void pte_set_dir(pte *entry, uint32_t dir)
+{
+	entry->ppn = (((uintptr_t)&page_directory_pool[dir][0]) - va_pa_offset()) >> 12;
+	entry->pte_v = entry->pte_d = 1;
+}
+
+/* Replace a 2 MiB leaf by a directory of the 512 4 KiB leaves it covered */
+static uint32_t split_megapage(trie *t, pte *entry)
+{
+	uint32_t dir = trie_new_dir(t);
+	pte leaf = *entry;
+	int j;
+
+	if (!dir)
+		return 0;
+	for (j = 0; j < 512; j++) {
+		page_directory_pool[dir][j]	= leaf;
+		page_directory_pool[dir][j].ppn = leaf.ppn + j;
+	}
+	*(uintptr_t *)entry = 0;
+	pte_set_dir(entry, dir);
+	return dir;
+}
+
+/* Turn the NAPOT group holding leaf idx of dir back into plain leaves */
+static void split_napot(pte *dir, uintptr_t idx)
+{
+	pte *group = &dir[idx & ~(NAPOT_PAGES - 1)];
+	int j;
+
+	for (j = 0; j < NAPOT_PAGES; j++) {
+		group[j].pte_n = 0;
+		group[j].ppn   = (group[j].ppn & ~(uintptr_t)(NAPOT_PAGES - 1)) | j;
+	}
+}
+
 /**
  * insert a va-pa pair to page table, maintained via a trie
  * @param t a trie to maintain used page directory in a pool, should be `static trie address_trie`
@@ -19,11 +79,12 @@ static trie address_trie __attribute__((section(".page_table_trie")));
  * @param pa the physical address corresponding to va
  * @param len the number of levels should be used. Note, it can be smaller than 3, which indicates a huge page
  * @param attr pte attribution, reserved for future
- * @return
+ * @return the leaf entry, NULL if the directory pool is used up or a 2 MiB
+ * leaf was asked for where smaller pages are already mapped
  */
-static uintptr_t trie_get_or_insert(trie *t, const uintptr_t va,
-				    const uintptr_t pa, const int len,
-				    const int attr)
+static pte *trie_get_or_insert(trie *t, const uintptr_t va,
+			       const uintptr_t pa, const int len,
+			       const int attr)
 {
 	uint32_t p = 0, i = 0;
 	/*
@@ -38,22 +99,29 @@ static uintptr_t trie_get_or_insert(trie *t, const uintptr_t va,
 
 	// for a three level page table, only two PPNs need to point to next level
 	for (; i < len - 1; i++) {
+		tmp_pte = &page_directory_pool[p][l[i]];
 		if (!t->next[p][l[i]]) {
-			t->next[p][l[i]] = ++t->cnt;
-			printd("page cnt:%d\n", t->cnt);
-			tmp_pte = &page_directory_pool[p][l[i]];
-			tmp_pte->ppn =
-				(((uintptr_t)&page_directory_pool[t->cnt][0]) - va_pa_offset())>>12;
-			tmp_pte->pte_v = tmp_pte->pte_d = 1;
+			if (tmp_pte->pte_v)
+				/* A 2 MiB leaf that a smaller page goes into */
+				t->next[p][l[i]] = split_megapage(t, tmp_pte);
+			else if ((t->next[p][l[i]] = trie_new_dir(t)))
+				pte_set_dir(tmp_pte, t->next[p][l[i]]);
+			if (!t->next[p][l[i]])
+				return NULL;
 		}
 		p = t->next[p][l[i]];
 	}
 
 	// set items for the leaf page table entry
 	tmp_pte	     = &page_directory_pool[p][l[len - 1]];
+	if (len == 2 && t->next[p][l[len - 1]])
+		return NULL;
+	if (len == 3 && tmp_pte->pte_n)
+		split_napot(page_directory_pool[p], l[len - 1]);
+	*(uintptr_t *)tmp_pte = 0;
 	tmp_pte->ppn = pa >> 12;
 	if (len == 2) {
-		tmp_pte->ppn = (tmp_pte->ppn | MASK_OFFSET) ^ MASK_OFFSET;
+		tmp_pte->ppn &= ~(uintptr_t)(MEGA_PAGES - 1);
 	}
 	tmp_pte->pte_v = tmp_pte->pte_d = tmp_pte->pte_a = 1;
 	tmp_pte->pte_r = tmp_pte->pte_w = tmp_pte->pte_x = 1;
@@ -62,15 +130,48 @@ static uintptr_t trie_get_or_insert(trie *t, const uintptr_t va,
 		tmp_pte->pte_u = 1;
 	}
 
-	return *((uintptr_t *)tmp_pte);
+	return tmp_pte;
+}
+
+static pte *page_directory_insert(uintptr_t va, uintptr_t pa, int levels,
+				  int attr)
+{
+	return trie_get_or_insert(&address_trie, va, pa, levels, attr);
+}
+
+/* 16 aligned 4 KiB leaves that share one 64 KiB TLB entry */
+static int napot_insert(uintptr_t va, uintptr_t pa, int attr)
+{
+	pte *leaf[NAPOT_PAGES];
+	int j;
+
+	for (j = 0; j < NAPOT_PAGES; j++) {
+		leaf[j] = page_directory_insert(va + ((uintptr_t)j << EPAGE_SHIFT),
+						pa + ((uintptr_t)j << EPAGE_SHIFT),
+						3, attr);
+		if (!leaf[j])
+			return 0;
+	}
+	for (j = 0; j < NAPOT_PAGES; j++) {
+		leaf[j]->ppn   = ((pa >> 12) & ~(uintptr_t)(NAPOT_PAGES - 1)) |
+			       (NAPOT_PAGES >> 1);
+		leaf[j]->pte_n = 1;
+	}
+	return 1;
 }
 
-static uintptr_t page_directory_insert(uintptr_t va, uintptr_t pa, int levels,
-				       int attr)
+/*
+ * Largest leaf, in pages, that maps va to pa and fits in n_pages: a 2 MiB
+ * leaf, a 64 KiB NAPOT group with Svnapot, or a single page.
+ */
+static size_t leaf_pages(uintptr_t va, uintptr_t pa, size_t n_pages)
 {
-	uintptr_t p = (uintptr_t)trie_get_or_insert(&address_trie, va, pa,
-						    levels, attr);
-	return p;
+	if (!((va | pa) & (EMEGA_PAGE_SIZE - 1)) && n_pages >= MEGA_PAGES)
+		return MEGA_PAGES;
+	if (napot_enabled && !((va | pa) & (NAPOT_SIZE - 1)) &&
+	    n_pages >= NAPOT_PAGES)
+		return NAPOT_PAGES;
+	return 1;
 }
 
 uintptr_t get_page_table_root()
@@ -79,11 +180,40 @@ uintptr_t get_page_table_root()
 	return (uintptr_t)&page_directory_pool[0][0];
 }
 
-uintptr_t get_pa(uintptr_t va)
+/*
+ * Direct mapped cache of 4 KiB translations in front of the table walk.
+ * Only valid translations are cached; anything that changes the table
+ * drops the entries it covers.
+ */
+static struct {
+	uintptr_t vpn;
+	uintptr_t ppn;
+} pa_cache[PA_CACHE_SIZE];
+
+#define PA_CACHE_SLOT(vpn) ((vpn) & (PA_CACHE_SIZE - 1))
+#define PA_CACHE_VALID     ((uintptr_t)1 << 63)
+
+static void pa_cache_invalidate(uintptr_t va, size_t n_pages)
+{
+	uintptr_t vpn = va >> EPAGE_SHIFT;
+	size_t i;
+
+	if (n_pages >= PA_CACHE_SIZE) {
+		for (i = 0; i < PA_CACHE_SIZE; i++)
+			pa_cache[i].vpn = 0;
+		return;
+	}
+	for (i = 0; i < n_pages; i++, vpn++) {
+		if (pa_cache[PA_CACHE_SLOT(vpn)].vpn == (vpn | PA_CACHE_VALID))
+			pa_cache[PA_CACHE_SLOT(vpn)].vpn = 0;
+	}
+}
+
+/* Walk the table for va, *leaf gets the size of the leaf that maps it */
+static uintptr_t walk_pa(uintptr_t va, uintptr_t *leaf)
 {
 	uintptr_t l[] = { (va & MASK_L2) >> 30, (va & MASK_L1) >> 21,
 			  (va & MASK_L0) >> 12 };
-	pte entry;
 	pte *root = (void*) get_page_table_root();
 	pte tmp_entry;
 	uintptr_t tmp;
@@ -101,33 +231,120 @@ uintptr_t get_pa(uintptr_t va)
 		root = (pte *)tmp;
 		i++;
 	}
-	if (i == 2)
+	if (i == 2 && tmp_entry.pte_n) {
+		*leaf = NAPOT_SIZE;
+		return ((tmp_entry.ppn & ~(uintptr_t)(NAPOT_PAGES - 1)) << 12) |
+		       (va & (NAPOT_SIZE - 1));
+	}
+	if (i == 2) {
+		*leaf = EPAGE_SIZE;
 		return (tmp_entry.ppn << 12) | (va & 0xfff);
-	else if (i == 1)
+	} else if (i == 1) {
+		*leaf = EMEGA_PAGE_SIZE;
 		return (tmp_entry.ppn >> 9) << 21 | (va & 0x1fffff);
-	else {
+	} else {
 		return 0;
 	}
 }
 
-void map_page(pte *root, uintptr_t va, uintptr_t pa, size_t n_pages,
-	      uintptr_t attr)
+uintptr_t get_pa(uintptr_t va)
 {
-	pte *pt;
-	printd("[doing_map_page]map_page(nullptr,0x%lx,0x%lx,%d,0);\n",va,pa,n_pages);
-	// while (n_pages >= 512) {
-	// 	page_directory_insert(va, pa, 2, attr);
-	// 	va += EPAGE_SIZE * 512;
-	// 	pa += EPAGE_SIZE * 512;
-	// 	n_pages -= 512;
-	// }
+	uintptr_t vpn = va >> EPAGE_SHIFT, leaf, pa;
+
+	if (pa_cache[PA_CACHE_SLOT(vpn)].vpn == (vpn | PA_CACHE_VALID))
+		return (pa_cache[PA_CACHE_SLOT(vpn)].ppn << EPAGE_SHIFT) |
+		       (va & MASK_OFFSET);
+	pa = walk_pa(va, &leaf);
+	if (pa) {
+		pa_cache[PA_CACHE_SLOT(vpn)].vpn = vpn | PA_CACHE_VALID;
+		pa_cache[PA_CACHE_SLOT(vpn)].ppn = pa >> EPAGE_SHIFT;
+	}
+	return pa;
+}
+
+/*
+ * Translate the start of [va, va + len) to *pa and return how many bytes
+ * from va on are physically contiguous, so callers can copy or DMA a
+ * whole extent at once. Returns 0 if va is not mapped.
+ */
+size_t get_pa_range(uintptr_t va, size_t len, uintptr_t *pa)
+{
+	uintptr_t leaf, next, run;
+
+	*pa = walk_pa(va, &leaf);
+	if (!*pa || !len)
+		return 0;
+	/* Up to the end of the leaf holding va */
+	run = leaf - (va & (leaf - 1));
+	while (run < len) {
+		next = walk_pa(va + run, &leaf);
+		if (next != *pa + run)
+			break;
+		run += leaf;
+	}
+	return run < len ? run : len;
+}
+uintptr_t unmap_page(uintptr_t va)
+{
+	trie *t = &address_trie;
+	uintptr_t l[] = { (va & MASK_L2) >> 30, (va & MASK_L1) >> 21,
+			  (va & MASK_L0) >> 12 };
+	uint32_t p = 0, i;
+	pte *entry;
+	uintptr_t pa;
 
+	for (i = 0; i < 2; i++) {
+		entry = &page_directory_pool[p][l[i]];
+		if (!t->next[p][l[i]]) {
+			if (!entry->pte_v)
+				return 0;
+			/* Inside a 2 MiB leaf, the rest of it stays mapped */
+			t->next[p][l[i]] = split_megapage(t, entry);
+			if (!t->next[p][l[i]])
+				return 0;
+		}
+		p = t->next[p][l[i]];
+	}
+
+	entry = &page_directory_pool[p][l[2]];
+	if (!entry->pte_v)
+		return 0;
+	if (entry->pte_n)
+		split_napot(page_directory_pool[p], l[2]);
+	pa		    = entry->ppn << 12;
+	*(uintptr_t *)entry = 0;
+	pa_cache_invalidate(va, 1);
+	return pa;
+}
+
+/*
+ * Map n_pages from va to pa with the largest leaves alignment allows.
+ * Returns EBI_ERROR, with only part of the range mapped, if the page
+ * directory pool runs out.
+ */
+int map_page(pte *root, uintptr_t va, uintptr_t pa, size_t n_pages,
+	     uintptr_t attr)
+{
+	size_t step;
+
+	printd("[doing_map_page]map_page(nullptr,0x%lx,0x%lx,%d,0);\n",va,pa,n_pages);
+	pa_cache_invalidate(va, n_pages);
 	while (n_pages >= 1) {
-		page_directory_insert(va, pa, 3, attr);
-		va += EPAGE_SIZE;
-		pa += EPAGE_SIZE;
-		n_pages--;
+		step = leaf_pages(va, pa, n_pages);
+		if (step == MEGA_PAGES && !page_directory_insert(va, pa, 2, attr))
+			/* Smaller pages already live in this 2 MiB */
+			step = napot_enabled ? NAPOT_PAGES : 1;
+		if (step == NAPOT_PAGES && !napot_insert(va, pa, attr))
+			step = 1;
+		if (step == 1 && !page_directory_insert(va, pa, 3, attr)) {
+			printd("OUT OF PAGE DIRECTORY\n");
+			return EBI_ERROR;
+		}
+		va += step << EPAGE_SHIFT;
+		pa += step << EPAGE_SHIFT;
+		n_pages -= step;
 	}
+	return EBI_OK;
 }
 
 static uintptr_t drv_va_start = 0;
@@ -136,33 +353,74 @@ uintptr_t ioremap(pte *root, uintptr_t pa, size_t size)
 	static uintptr_t drv_addr_alloc = 0;
 	printd("current root address: %p",get_page_table_root());
 	size_t n_pages		      = PAGE_UP(size) >> EPAGE_SHIFT;
-	map_page(root,  EDRV_DRV_START + drv_addr_alloc, pa, n_pages,
-		 PTE_V | PTE_W | PTE_R | PTE_D | PTE_X);
+	if (map_page(root,  EDRV_DRV_START + drv_addr_alloc, pa, n_pages,
+		     PTE_V | PTE_W | PTE_R | PTE_D | PTE_X))
+		return 0;
 	uintptr_t cur_addr =  EDRV_DRV_START;
 	drv_addr_alloc += n_pages << 12;
 	return cur_addr;
 }
 
+/* Whether any page of [va, va + n_pages) is mapped */
+static int range_mapped(uintptr_t va, size_t n_pages)
+{
+	uintptr_t leaf;
+
+	for (; n_pages; n_pages--, va += EPAGE_SIZE) {
+		if (walk_pa(va, &leaf))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Back n_pages at va with fresh zeroed pages. Where va is aligned for a
+ * large leaf the pool is asked for a contiguous aligned run first.
+ * Returns the PA backing va, or 0 if the pages or the page directories to
+ * map them run out. Pages mapped before that stay mapped.
+ */
 uintptr_t alloc_page(pte *root, uintptr_t va, size_t n_pages, uintptr_t attr,
 		     char id)
 {
-	pte *pt;
-	uintptr_t pa;
+	uintptr_t pa = 0, first = 0, page;
+	size_t run;
 
 	while (n_pages >= 1) {
-		pa = spa_get_pa_zero(id);
-		page_directory_insert(va, pa, 3, attr);
-		va += EPAGE_SIZE;
-		pa += EPAGE_SIZE;
-		n_pages--;
+		run = leaf_pages(va, 0, n_pages);
+		if (run == MEGA_PAGES && !(pa = spa_get_run_pa_zero(id, run)))
+			run = napot_enabled ? NAPOT_PAGES : 1;
+		if (run == NAPOT_PAGES && !(pa = spa_get_run_pa_zero(id, run)))
+			run = 1;
+		if (run == 1) {
+			/* Take whatever contiguous run the pool has at hand */
+			run  = n_pages;
+			page = spa_get_n(id, &run);
+			if (!page) {
+				printd("OUT OF PAGE\n");
+				return 0;
+			}
+			memset((char *)page, 0, run << EPAGE_SHIFT);
+			pa = page - va_pa_offset();
+		}
+		if (map_page(root, va, pa, run, attr)) {
+			/* Pages of a part mapped run are left to their PTEs */
+			if (!range_mapped(va, run))
+				spa_put_n(pa + va_pa_offset(), run, id);
+			return 0;
+		}
+		if (!first)
+			first = pa;
+		va += run << EPAGE_SHIFT;
+		n_pages -= run;
 	}
+	return first;
 }
 
 void all_zero()
 {
 	int i, j;
 	pte *tmp_pte;
-	for (i = 0; i < 64; i++) {
+	for (i = 0; i < PAGE_DIR_POOL; i++) {
 		for (j = 0; j < 512; j++) {
 			tmp_pte = &page_directory_pool[i][j];
 			if (*((uintptr_t *)tmp_pte)) {
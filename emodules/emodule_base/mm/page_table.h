@@ -5,6 +5,12 @@
 #define EDRV_PA_START    0x80000000
 #define EDRV_VA_START    0xC0000000
 #define EDRV_DRV_START   0xD0000000
+#define EDRV_RING_VA     0xE0000000
+/* Host window shared with the payload, above any heap or stack */
+#define EUSR_SHARE_VA    0x40000000
+/* Anonymous mmap() ranges are placed in [EUSR_MMAP_START, EUSR_MMAP_END) */
+#define EUSR_MMAP_START  0x20000000
+#define EUSR_MMAP_END    EUSR_SHARE_VA
 #define EDRV_VA_PA_OFFSET     (EDRV_VA_START - EDRV_PA_START)
 
 
@@ -19,8 +25,18 @@
 #define MASK_L1 0x3fe00000
 #define MASK_L2 0x7fc0000000
 
-// Pool size for page table itself
-#define PAGE_DIR_POOL 64 
+#define MEGA_PAGES       512    // 4 KiB pages under a 2 MiB leaf
+#define EMEGA_PAGE_SIZE  (MEGA_PAGES * EPAGE_SIZE)
+#define NAPOT_PAGES      16     // 4 KiB pages in a 64 KiB Svnapot group
+#define NAPOT_SIZE       (NAPOT_PAGES * EPAGE_SIZE)
+
+// Pool size for page table itself, one directory per 2 MiB of 4 KiB pages
+#ifndef PAGE_DIR_POOL
+#define PAGE_DIR_POOL 64
+#endif
+
+// Entries in the get_pa() translation cache, a power of two
+#define PA_CACHE_SIZE 64
 
 #ifndef __ASSEMBLER__
 
@@ -37,7 +53,8 @@ typedef struct pte {
     uint32_t pte_d: 1;
     uint32_t rsw: 2;
     uintptr_t ppn: 44;
-    uintptr_t __unused_value: 10;
+    uintptr_t __unused_value: 9;
+    uintptr_t pte_n: 1;
 } pte;
 
 
@@ -46,12 +63,15 @@ typedef struct trie {
 } trie;
 typedef pte page_directory[512];
 
-void map_page(pte *, uintptr_t, uintptr_t, size_t, uintptr_t);
+int map_page(pte *, uintptr_t, uintptr_t, size_t, uintptr_t);
 uintptr_t ioremap(pte *, uintptr_t, size_t);
 uintptr_t alloc_page(pte *, uintptr_t, size_t, uintptr_t, char);
+uintptr_t unmap_page(uintptr_t);
 uintptr_t get_pa(uintptr_t);
+size_t get_pa_range(uintptr_t, size_t, uintptr_t *);
 uintptr_t get_page_table_root(void);
 void all_zero(void);
+void page_table_enable_napot(int enable);
 // pte* get_pte(pte*, uintptr_t, char);
 
 #endif
\ No newline at end of file
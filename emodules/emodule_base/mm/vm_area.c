@@ -0,0 +1,114 @@
+#include "vm_area.h"
+#include "../drv_util.h"
+
+static vm_area_t vm_areas[MAX_VMA];
+
+static vm_area_t *vma_slot(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_VMA; i++) {
+		if (vm_areas[i].start == vm_areas[i].end)
+			return &vm_areas[i];
+	}
+	return 0;
+}
+
+/*
+ * Add [start, end) with PTE attributes attr, merged into an area it
+ * overlaps or touches if they have the same attributes. Returns -1 when
+ * the table is full.
+ */
+int vma_add(uintptr_t start, uintptr_t end, uintptr_t attr)
+{
+	vm_area_t *vma, *free;
+	int i;
+
+	if (start >= end)
+		return 0;
+	for (i = 0; i < MAX_VMA; i++) {
+		vma = &vm_areas[i];
+		if (vma->start == vma->end)
+			continue;
+		if (vma->attr == attr && start <= vma->end && end >= vma->start) {
+			if (start < vma->start)
+				vma->start = start;
+			if (end > vma->end)
+				vma->end = end;
+			return 0;
+		}
+	}
+	free = vma_slot();
+	if (!free) {
+		printd("[vma_add] no room for 0x%lx - 0x%lx\n", start, end);
+		return -1;
+	}
+	free->start = start;
+	free->end   = end;
+	free->attr  = attr;
+	return 0;
+}
+
+/*
+ * Drop [start, end) from every area it overlaps. An area it falls in the
+ * middle of is split in two, which fails with -1 when the table is full.
+ */
+int vma_remove(uintptr_t start, uintptr_t end)
+{
+	vm_area_t *vma, *tail;
+	int i;
+
+	for (i = 0; i < MAX_VMA; i++) {
+		vma = &vm_areas[i];
+		if (vma->start == vma->end || end <= vma->start ||
+		    start >= vma->end)
+			continue;
+		if (start <= vma->start && end >= vma->end) {
+			vma->start = vma->end = 0;
+		} else if (start <= vma->start) {
+			vma->start = end;
+		} else if (end >= vma->end) {
+			vma->end = start;
+		} else {
+			tail = vma_slot();
+			if (!tail)
+				return -1;
+			tail->start = end;
+			tail->end   = vma->end;
+			tail->attr  = vma->attr;
+			vma->end    = start;
+		}
+	}
+	return 0;
+}
+
+/* Lowest len bytes of [lo, hi) that no area covers, 0 if there are none */
+uintptr_t vma_find_free(uintptr_t lo, uintptr_t hi, uintptr_t len)
+{
+	uintptr_t va = lo;
+	int i, moved = 1;
+
+	while (moved) {
+		moved = 0;
+		if (va + len > hi || va + len < va)
+			return 0;
+		for (i = 0; i < MAX_VMA; i++) {
+			if (vm_areas[i].start < va + len && vm_areas[i].end > va) {
+				va    = vm_areas[i].end;
+				moved = 1;
+			}
+		}
+	}
+	return va;
+}
+
+vm_area_t *vma_find(uintptr_t va)
+{
+	int i;
+
+	for (i = 0; i < MAX_VMA; i++) {
+		if (va >= vm_areas[i].start && va < vm_areas[i].end)
+			return &vm_areas[i];
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/*
+ * User ranges backed on demand. A page of one of them is only taken from
+ * the USR pool, zeroed and mapped when it is first touched, so reserved
+ * but unused bss, heap and stack cost nothing.
+ */
+#define MAX_VMA 32
+
+typedef struct {
+	uintptr_t start;
+	uintptr_t end;
+	uintptr_t attr;
+} vm_area_t;
+
+int vma_add(uintptr_t start, uintptr_t end, uintptr_t attr);
+int vma_remove(uintptr_t start, uintptr_t end);
+vm_area_t *vma_find(uintptr_t va);
+uintptr_t vma_find_free(uintptr_t lo, uintptr_t hi, uintptr_t len);
+#endif
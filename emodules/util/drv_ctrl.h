@@ -11,6 +11,7 @@ typedef struct {
 	uintptr_t drv_start;
 	uintptr_t drv_end;
 	int using_by;
+	int id; /* index in bbl_addr_list, what FETCH and RELEASE take */
 } drv_addr_t;
 
 #define MAX_DRV 64
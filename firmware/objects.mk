@@ -24,6 +24,42 @@ firmware-cflags-y   +=	-fPIE -pie
 firmware-ldflags-y  +=	-Wl,--no-dynamic-linker -Wl,-pie
 endif
 
+ifeq ($(FW_BENCH),y)
+firmware-genflags-y += -DFW_BENCH
+endif
+
+ifdef SBI_LOG_LEVEL_EBI
+firmware-genflags-y += -DSBI_LOG_LEVEL_EBI=$(SBI_LOG_LEVEL_EBI)
+endif
+
+ifdef SBI_LOG_LEVEL_ECALL
+firmware-genflags-y += -DSBI_LOG_LEVEL_ECALL=$(SBI_LOG_LEVEL_ECALL)
+endif
+
+ifdef EBI_POOL_SIZE
+firmware-genflags-y += -DEBI_POOL_SIZE=$(EBI_POOL_SIZE)
+endif
+
+ifdef EBI_POOL_DRV_MASK
+firmware-genflags-y += -DEBI_POOL_DRV_MASK=$(EBI_POOL_DRV_MASK)
+endif
+
+ifdef EBI_DRV_FETCH_MAX_TICKS
+firmware-genflags-y += -DEBI_DRV_FETCH_MAX_TICKS=$(EBI_DRV_FETCH_MAX_TICKS)
+endif
+
+ifeq ($(EBI_SVNAPOT),y)
+firmware-genflags-y += -DEBI_SVNAPOT
+endif
+
+ifeq ($(EBI_ASID_RESERVED),y)
+firmware-genflags-y += -DEBI_ASID_RESERVED
+endif
+
+ifeq ($(FW_RVV),y)
+firmware-genflags-y += -DFW_RVV
+endif
+
 ifdef FW_TEXT_START
 firmware-genflags-y += -DFW_TEXT_START=$(FW_TEXT_START)
 endif
@@ -9,19 +9,23 @@
 
 #include <sbi/sbi_ecall_interface.h>
 
-#define SBI_ECALL(__num, __a0, __a1, __a2)                                    \
+#define SBI_ECALL_FN(__num, __fid, __a0, __a1, __a2)                         \
 	({                                                                    \
 		register unsigned long a0 asm("a0") = (unsigned long)(__a0);  \
 		register unsigned long a1 asm("a1") = (unsigned long)(__a1);  \
 		register unsigned long a2 asm("a2") = (unsigned long)(__a2);  \
+		register unsigned long a6 asm("a6") = (unsigned long)(__fid); \
 		register unsigned long a7 asm("a7") = (unsigned long)(__num); \
 		asm volatile("ecall"                                          \
-			     : "+r"(a0)                                       \
-			     : "r"(a1), "r"(a2), "r"(a7)                      \
+			     : "+r"(a0), "+r"(a1)                             \
+			     : "r"(a2), "r"(a6), "r"(a7)                      \
 			     : "memory");                                     \
 		a0;                                                           \
 	})
 
+#define SBI_ECALL(__num, __a0, __a1, __a2) \
+	SBI_ECALL_FN(__num, 0, __a0, __a1, __a2)
+
 #define SBI_ECALL_0(__num) SBI_ECALL(__num, 0, 0, 0)
 #define SBI_ECALL_1(__num, __a0) SBI_ECALL(__num, __a0, 0, 0)
 #define SBI_ECALL_2(__num, __a0, __a1) SBI_ECALL(__num, __a0, __a1, 0)
@@ -39,9 +43,96 @@ static inline void sbi_ecall_console_puts(const char *str)
 		__asm__ __volatile__("wfi" ::: "memory"); \
 	} while (0)
 
+#ifdef FW_BENCH
+
+#define BENCH_ECALL_ITERS 1000
+
+struct bench_ecall {
+	const char *name;
+	unsigned long extid, fid, a0;
+};
+
+static inline unsigned long rdcycle(void)
+{
+	unsigned long c;
+
+	__asm__ __volatile__("rdcycle %0" : "=r"(c));
+	return c;
+}
+
+static void put_dec(unsigned long v)
+{
+	char buf[24];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = '\0';
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	sbi_ecall_console_puts(&buf[i]);
+}
+
+static void bench_row(const char *name, unsigned long cycles)
+{
+	sbi_ecall_console_puts("  ");
+	sbi_ecall_console_puts(name);
+	sbi_ecall_console_puts(": ");
+	put_dec(cycles / BENCH_ECALL_ITERS);
+	sbi_ecall_console_puts(" cycles/ecall\n");
+}
+
+/*
+ * Time the ecall round trip of one side effect free call per extension.
+ * The last row alternates two extensions, so every call misses the per
+ * hart last hit cache and goes through the dispatch table.
+ */
+static void bench_ecalls(unsigned long hartid)
+{
+	const struct bench_ecall calls[] = {
+		{ "base  ", SBI_EXT_BASE, SBI_EXT_BASE_GET_SPEC_VERSION, 0 },
+		{ "time  ", SBI_EXT_TIME, SBI_EXT_TIME_SET_TIMER, -1UL },
+		{ "ipi   ", SBI_EXT_IPI, SBI_EXT_IPI_SEND_IPI, 0 },
+		{ "rfence", SBI_EXT_RFENCE, SBI_EXT_RFENCE_REMOTE_FENCE_I, 0 },
+		{ "hsm   ", SBI_EXT_HSM, SBI_EXT_HSM_HART_GET_STATUS, hartid },
+		{ "pmu   ", SBI_EXT_PMU, SBI_EXT_PMU_NUM_COUNTERS, 0 },
+		{ "legacy", SBI_EXT_0_1_CONSOLE_GETCHAR, 0, 0 },
+		{ "vendor", SBI_EXT_VENDOR_START, 0, 0 },
+		{ "ebi   ", SBI_EXT_EBI, SBI_EXT_EBI_QUERY,
+		  SBI_EXT_EBI_STAT_POOL_HIT },
+		/* Nothing is registered in the firmware specific range */
+		{ "none  ", SBI_EXT_FIRMWARE_START, 0, 0 },
+	};
+	unsigned long start;
+	int i, j;
+
+	sbi_ecall_console_puts("ecall round trip:\n");
+	for (i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+		start = rdcycle();
+		for (j = 0; j < BENCH_ECALL_ITERS; j++)
+			SBI_ECALL_FN(calls[i].extid, calls[i].fid, calls[i].a0,
+				     0, 0);
+		bench_row(calls[i].name, rdcycle() - start);
+	}
+
+	start = rdcycle();
+	for (j = 0; j < BENCH_ECALL_ITERS / 2; j++) {
+		SBI_ECALL_FN(SBI_EXT_BASE, SBI_EXT_BASE_GET_SPEC_VERSION, 0, 0,
+			     0);
+		SBI_ECALL_FN(SBI_EXT_EBI, SBI_EXT_EBI_QUERY,
+			     SBI_EXT_EBI_STAT_POOL_HIT, 0, 0);
+	}
+	bench_row("mixed ", rdcycle() - start);
+}
+
+#endif
+
 void test_main(unsigned long a0, unsigned long a1)
 {
 	sbi_ecall_console_puts("\nTest payload running\n");
+#ifdef FW_BENCH
+	bench_ecalls(a0);
+#endif
 
 	while (1)
 		wfi();
@@ -162,6 +162,15 @@ void csr_write_num(int csr_num, unsigned long val);
 		__asm__ __volatile__("ebreak" ::: "memory"); \
 	} while (0)
 
+/* Zicboz cbo.zero, as .insn so the assembler need not know Zicboz */
+#define cbo_zero(addr)                                               \
+	do {                                                         \
+		__asm__ __volatile__(".insn i 0x0f, 2, x0, %0, 4"    \
+				     :                               \
+				     : "r"(addr)                     \
+				     : "memory");                    \
+	} while (0)
+
 /* Get current HART id */
 #define current_hartid()	((unsigned int)csr_read(CSR_MHARTID))
 
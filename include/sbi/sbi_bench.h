@@ -0,0 +1,16 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_BENCH_H__
+#define __SBI_BENCH_H__
+
+#include <sbi/sbi_types.h>
+
+/* Print a bytes per cycle figure, as x.yy, for one measurement */
+void sbi_bench_report(const char *name, size_t bytes, unsigned long cycles);
+
+/* Run the boot time micro-benchmarks (only built with FW_BENCH=y) */
+void sbi_bench_run(void);
+
+#endif
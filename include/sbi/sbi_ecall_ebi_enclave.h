@@ -75,9 +75,15 @@
 #define EBI_GOTO 402
 #define EBI_FETCH 403
 #define EBI_RELEASE 404
+#define EBI_PAUSE 405
+#define EBI_RESUME 406
+#define EBI_QUERY 407
+#define EBI_RING 408
+#define EBI_SHARE 409
 
 #define EBI_PUTS 410
 #define EBI_GETS 411
+#define EBI_MEASURE 412
 
 #define EBI_OK 0
 #define EBI_ERROR -1
@@ -95,6 +101,9 @@
 #define ENC_IDLE 0x2 // Paused Enclave
 #define ENC_RUN 0x3  // Running Enclave
 
+/* Id of a host context that has no enclave entered */
+#define EBI_HOST_ID ((uintptr_t)-1)
+
 #define PTE_ATTR_MASK 0xFFFFFC00
 
 #define MASK(n) ((1 << (n)) - 1)
@@ -103,6 +112,11 @@
 
 /* Based on 64 bits Sv39 Page */
 #define SATP_MODE_SHIFT 60
+#if __riscv_xlen == 64
+#define SATP_ASID_SHIFT 44
+#else
+#define SATP_ASID_SHIFT 22
+#endif
 #define EPAGE_SHIFT 12
 #define EPAGE_SIZE (1 << EPAGE_SHIFT)
 #define EMEGA_PAGE_SHIFT 21
@@ -122,6 +136,16 @@
 #define EUSR_MEM_SIZE (EMEM_SIZE - EDRV_MEM_SIZE)
 #define EUSR_STACK_SIZE 0x8000
 #define EUSR_HEAP_STACK_RATIO 10
+/* Spare user memory beyond the payload: stack, bss and an initial heap */
+#define EUSR_MEM_MIN 0x40000
+/* Spare driver memory beyond the images: stack and page pool headroom */
+#define EDRV_MEM_MIN (EDRV_STACK_SIZE + 0x10000)
+/* Room reserved for the user parameter block copied in on enter */
+#define EPARAM_SIZE EPAGE_SIZE
+/* Largest host call ring an enclave may be given */
+#define EBI_RING_MAX_SIZE (16 * EPAGE_SIZE)
+/* Largest shared window, two leaf page tables in emodule_base */
+#define EBI_SHARE_MAX_SIZE (2 * EMEGA_PAGE_SIZE)
 #define ROUND_UP(addr, size) (((addr) + ((size)-1)) & (~((size)-1)))
 #define PAGE_UP(addr) (ROUND_UP(addr, EPAGE_SIZE))
 #define PAGE_DOWN(addr) ((addr) & (~((EPAGE_SIZE)-1)))
@@ -139,8 +163,44 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <sbi/riscv_atomic.h>
+#include <sbi/riscv_locks.h>
+#include <sbi/sbi_ecall_ebi_measure.h>
+#include <sbi/sbi_hartmask.h>
 #include <sbi/sbi_trap.h>
 
+/*
+ * Handed to emodule_base in a6 on the first enter. It lives in the driver
+ * region right after the driver address list.
+ */
+typedef struct {
+	uintptr_t usr_mem_size;
+	uintptr_t drv_mem_size;
+	/* First PA of the driver region not taken by images or parameters */
+	uintptr_t drv_free_start;
+	/* ASID to put in satp, 0 if the hart has none to spare */
+	uintptr_t asid;
+	/* Host call ring attached before the first enter, size 0 if none */
+	uintptr_t ring_pa;
+	uintptr_t ring_size;
+	/* Host window shared with the payload, size 0 if none */
+	uintptr_t share_pa;
+	uintptr_t share_size;
+	/* EBI_BOOT_* */
+	uintptr_t flags;
+} ebi_boot_info_t;
+
+/* The harts implement Svnapot, emodule_base may map 64KiB NAPOT leaves */
+#define EBI_BOOT_SVNAPOT 0x1
+
+/* Where the driver region of a freshly laid out enclave keeps its parts */
+typedef struct {
+	uintptr_t drv_list;
+	uintptr_t boot_info;
+	uintptr_t user_param;
+	/* Hash of the images copied so far, the payload goes on top */
+	struct ebi_measure measure;
+} enclave_layout_t;
+
 typedef struct {
 	uintptr_t id;
 
@@ -156,10 +216,27 @@ typedef struct {
 
 	uintptr_t pa;
 	uintptr_t mem_size;
+	uintptr_t usr_size;
+	uintptr_t drv_size;
 	uintptr_t enclave_binary_size;
 	uintptr_t drv_list;
+	uintptr_t boot_info;
 	uintptr_t user_param;
 	uintptr_t umode_context[MAX_INDEX];
+	uintptr_t asid;
+	/* Host pages granted to the enclave for the call ring */
+	uintptr_t ring_pa;
+	uintptr_t ring_size;
+	/* Host pages shared with the payload for bulk inputs and results */
+	uintptr_t share_pa;
+	uintptr_t share_size;
+	/* Root page table of the only host context that may drive it */
+	uintptr_t owner;
+	/* Harts that may still cache translations of a previous occupant */
+	struct sbi_hartmask tlb_stale;
+	/* SHA-256 of the base module, drivers and payload at create */
+	u8 measurement[EBI_DIGEST_SIZE];
+	spinlock_t lock;
 	char status;
 } enclave_context;
 void pmp_switch(enclave_context *context);
@@ -167,18 +244,21 @@ extern uintptr_t create_enclave(const struct sbi_trap_regs *args,
 				uintptr_t mepc);
 extern uintptr_t enter_enclave(struct sbi_trap_regs *args, uintptr_t mepc);
 extern uintptr_t exit_enclave(struct sbi_trap_regs *regs);
-extern uintptr_t pause_enclave(uintptr_t id, uintptr_t *regs, uintptr_t mepc);
-extern uintptr_t resume_enclave(uintptr_t id, uintptr_t *regs);
+extern uintptr_t pause_enclave(struct sbi_trap_regs *regs, uintptr_t mepc);
+extern uintptr_t resume_enclave(struct sbi_trap_regs *regs, uintptr_t mepc);
+extern uintptr_t attach_ring(const struct sbi_trap_regs *regs);
+extern uintptr_t share_window(const struct sbi_trap_regs *regs);
+extern uintptr_t measure_enclave(const struct sbi_trap_regs *regs);
 extern void init_enclaves(void);
+bool enclave_host_idle(u32 hartid);
+bool enclave_hart_idle(u32 hartid);
+void enclave_tlb_get_stats(unsigned long *flushes, unsigned long *switches);
+void enclave_layout(uintptr_t pa, uintptr_t usr_size, uintptr_t drv_size,
+		    uintptr_t driver_bitmask, enclave_layout_t *layout);
 
 #define PHY_MEM_START 0x80000000UL
 #define PHY_MEM_END 0x80000000UL
 
-typedef struct {
-	uintptr_t pa;
-	char status;
-} enclave_page_t;
-
 extern char _enclave_start, _enclave_end;
 extern char _base_start, _base_end;
 
@@ -186,7 +266,7 @@ typedef uintptr_t pte;
 
 void enclave_mem_init(void);
 uintptr_t enclave_mem_alloc(enclave_context *context, size_t enclave_size);
-uintptr_t enclave_mem_free(enclave_context *context);
+uintptr_t enclave_mem_free(enclave_context *context, bool clean);
 
 typedef uintptr_t (*cmd_handler)(uintptr_t cmd, uintptr_t arg0, uintptr_t arg1,
 				 uintptr_t arg2);
@@ -198,15 +278,42 @@ typedef struct {
 	uintptr_t drv_start;
 	uintptr_t drv_end;
 	int using_by;
+	int id; /* index in bbl_addr_list, what FETCH and RELEASE take */
 } drv_addr_t;
 
 #define MAX_DRV 64
 #define QUERY_INFO -1
 
 extern drv_addr_t bbl_addr_list[64];
-uintptr_t drvcpy(uintptr_t *start_addr, uintptr_t bitmask);
-char drvfetch(int drv_id, int enclave_id);
-void drvrelease(int drv_id, int enclave_id);
+uintptr_t drvcpy(uintptr_t *start_addr, uintptr_t bitmask,
+		 struct ebi_measure *m);
+uintptr_t drvsize(uintptr_t bitmask);
+
+/* Contention counters of one driver's ownership lock */
+struct enclave_drv_stats {
+	/* Fetches that did not already own the driver */
+	unsigned long acquires;
+	/* Fetches that found it owned and had to queue */
+	unsigned long contended;
+	/* Releases that passed it straight to a waiter */
+	unsigned long handoffs;
+	/* Waits given up on at the deadline */
+	unsigned long timeouts;
+};
+
+/*
+ * Longest an enclave may wait for a driver, in timer ticks. Waiting parks
+ * the hart its host would otherwise run on.
+ */
+#ifndef EBI_DRV_FETCH_MAX_TICKS
+#define EBI_DRV_FETCH_MAX_TICKS 10000000ULL
+#endif
+
+int drvfetch(int enclave_id, int driver_id, u64 timeout);
+void drvrelease(int enclave_id, int driver_id);
+void enclave_drv_get_stats(int driver_id, struct enclave_drv_stats *stats);
+extern uintptr_t fetch_driver(const struct sbi_trap_regs *regs);
+extern uintptr_t release_driver(const struct sbi_trap_regs *regs);
 
 // Currently, interrupts are always disabled in M-mode.
 #define disable_irqsave() (0)
@@ -0,0 +1,32 @@
+#pragma once
+// See LICENSE for license details.
+
+#include <sbi/sbi_types.h>
+
+/*
+ * SHA-256 measurement of what goes into an enclave. The image is hashed
+ * while it is copied into enclave memory, so every byte is read once:
+ *
+ *   base module || drivers in id order || payload
+ *
+ * Pages an image copy skips because they are zero are still hashed, so
+ * the digest covers the whole image as the enclave sees it. On harts
+ * that implement Zknh the round functions use its instructions.
+ */
+
+#define EBI_DIGEST_SIZE 32
+#define EBI_SHA256_BLOCK 64
+
+struct ebi_measure {
+	u32 state[8];
+	/* Bytes hashed so far, the tail of an unfinished block is in buf */
+	u64 len;
+	u8 buf[EBI_SHA256_BLOCK];
+};
+
+void ebi_measure_start(struct ebi_measure *m);
+void ebi_measure_update(struct ebi_measure *m, const void *data, size_t len);
+void ebi_measure_copy(struct ebi_measure *m, void *dst, const void *src,
+		      size_t len);
+void ebi_measure_zero(struct ebi_measure *m, size_t len);
+void ebi_measure_finish(struct ebi_measure *m, u8 *digest);
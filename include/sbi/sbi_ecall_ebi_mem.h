@@ -0,0 +1,64 @@
+#pragma once
+// See LICENSE for license details.
+
+#include <sbi/sbi_types.h>
+
+/*
+ * Buddy allocator over the enclave carve-out (_enclave_start.._enclave_end).
+ *
+ * Every page of the carve-out has a small descriptor; the first page of a
+ * free block carries the block order and links it into the free list of
+ * that order. Allocation and free are O(log n) in the size of the pool and
+ * each coalescing step is O(1).
+ *
+ * Pages also remember whether they were scrubbed when they were freed, so
+ * emem_zero() only has to clear the ones that may still hold stale data.
+ * Memory freed with emem_free_dirty() is scrubbed by suspended harts, or
+ * by emem_alloc() once memory runs short, and only reaches the free lists
+ * once it is clean.
+ */
+
+#define EMEM_MAX_PAGE 8192
+#define EMEM_MAX_ORDER 13 // 2^13 pages, the whole of EMEM_MAX_PAGE
+#define EMEM_NIL 0xffff
+
+#define EMEM_PAGE_FREE 0x1 // page is the head of a free block
+#define EMEM_PAGE_CLEAN 0x2 // page is known to be all zeroes
+
+#define EMEM_SCRUB_SLOTS 16 // extents waiting to be scrubbed
+#define EMEM_SCRUB_CHUNK (64 * EPAGE_SIZE) // zeroed per claim, 256 KiB
+
+struct emem_page {
+	u16 next;
+	u16 prev;
+	u8 order;
+	u8 flags;
+};
+
+struct enclave_mem_stats {
+	/* Pages managed by the allocator */
+	unsigned long total_pages;
+	/* Pages currently free */
+	unsigned long free_pages;
+	/* Size of the largest free block, in pages */
+	unsigned long largest_free;
+	/* Number of free blocks over all orders */
+	unsigned long free_blocks;
+	/* Number of free blocks per order */
+	unsigned long order_blocks[EMEM_MAX_ORDER + 1];
+	/* Free pages known to be zeroed */
+	unsigned long clean_pages;
+	/* 0 when all free memory is in one block, towards 100 as it splinters */
+	unsigned long frag_percent;
+	/* Pages freed dirty and not yet scrubbed back into the pool */
+	unsigned long scrub_pages;
+};
+
+int emem_init(uintptr_t base, size_t size);
+uintptr_t emem_alloc(size_t size);
+void emem_free(uintptr_t pa, size_t size, bool clean);
+void emem_free_dirty(uintptr_t pa, size_t size);
+void emem_scrub_init(void);
+size_t emem_zero(uintptr_t pa, size_t size);
+void emem_get_stats(struct enclave_mem_stats *stats);
+void emem_dump_stats(void);
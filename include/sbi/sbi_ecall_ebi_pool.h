@@ -0,0 +1,39 @@
+#pragma once
+
+#include <sbi/sbi_ecall_ebi_enclave.h>
+
+/*
+ * Warm pool of enclave memory that already has the base module and the
+ * default drivers laid out. A create with the default sizes and driver
+ * set takes one and only has to copy its payload in. The pool is topped
+ * up by an IPI to a hart its host has suspended, once entries are used
+ * up. While no hart is idle the pool drains and creates lay out their
+ * enclave themselves. It is off unless EBI_POOL_SIZE is configured.
+ */
+
+#ifndef EBI_POOL_SIZE
+#define EBI_POOL_SIZE 0
+#endif
+
+#ifndef EBI_POOL_DRV_MASK
+#define EBI_POOL_DRV_MASK 0x1
+#endif
+
+struct enclave_pool_stats {
+	/* Creates served from the pool */
+	unsigned long hits;
+	/* Creates that had to lay out an enclave themselves */
+	unsigned long misses;
+	/* Entries prepared since boot */
+	unsigned long refills;
+	/* Entries ready right now */
+	unsigned long ready;
+};
+
+void enclave_pool_init(uintptr_t usr_size, uintptr_t drv_size);
+bool enclave_pool_get(uintptr_t usr_size, uintptr_t drv_size,
+		      uintptr_t driver_bitmask, uintptr_t *pa,
+		      enclave_layout_t *layout);
+bool enclave_pool_shrink(void);
+void enclave_pool_kick(void);
+void enclave_pool_get_stats(struct enclave_pool_stats *stats);
@@ -255,9 +255,28 @@ enum sbi_pmu_ctr_type {
 #define SBI_EXT_EBI_GOTO    402
 #define SBI_EXT_EBI_FETCH   403
 #define SBI_EXT_EBI_RELEASE 404
+#define SBI_EXT_EBI_PAUSE   405
+#define SBI_EXT_EBI_RESUME  406
+#define SBI_EXT_EBI_QUERY   407
+#define SBI_EXT_EBI_RING    408
+#define SBI_EXT_EBI_SHARE   409
+
+/* Counters readable through SBI_EXT_EBI_QUERY */
+#define SBI_EXT_EBI_STAT_POOL_HIT	0
+#define SBI_EXT_EBI_STAT_POOL_MISS	1
+#define SBI_EXT_EBI_STAT_POOL_REFILL	2
+#define SBI_EXT_EBI_STAT_POOL_READY	3
+#define SBI_EXT_EBI_STAT_TLB_FLUSH	4
+#define SBI_EXT_EBI_STAT_SWITCH		5
+/* Per driver ownership counters, a1 = driver id */
+#define SBI_EXT_EBI_STAT_DRV_ACQUIRE	6
+#define SBI_EXT_EBI_STAT_DRV_CONTEND	7
+#define SBI_EXT_EBI_STAT_DRV_HANDOFF	8
+#define SBI_EXT_EBI_STAT_DRV_TIMEOUT	9
 
 #define SBI_EXT_EBI_PUTS    410
 #define SBI_EXT_EBI_GETS    411
+#define SBI_EXT_EBI_MEASURE 412
 
 /* clang-format on */
 
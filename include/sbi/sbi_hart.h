@@ -22,9 +22,13 @@ enum sbi_hart_features {
 	SBI_HART_HAS_MCOUNTINHIBIT = (1 << 2),
 	/** HART has timer csr implementation in hardware */
 	SBI_HART_HAS_TIME = (1 << 3),
+	/** Hart has Zicboz cbo.zero */
+	SBI_HART_HAS_ZICBOZ = (1 << 4),
+	/** Hart has Zknh SHA-256 instructions */
+	SBI_HART_HAS_ZKNH = (1 << 5),
 
 	/** Last index of Hart features*/
-	SBI_HART_HAS_LAST_FEATURE = SBI_HART_HAS_TIME,
+	SBI_HART_HAS_LAST_FEATURE = SBI_HART_HAS_ZKNH,
 };
 
 struct sbi_scratch;
@@ -45,6 +49,7 @@ unsigned int sbi_hart_pmp_count(struct sbi_scratch *scratch);
 unsigned long sbi_hart_pmp_granularity(struct sbi_scratch *scratch);
 unsigned int sbi_hart_pmp_addrbits(struct sbi_scratch *scratch);
 unsigned int sbi_hart_mhpm_bits(struct sbi_scratch *scratch);
+unsigned long sbi_hart_cboz_block_size(struct sbi_scratch *scratch);
 int sbi_hart_pmp_configure(struct sbi_scratch *scratch);
 bool sbi_hart_has_feature(struct sbi_scratch *scratch, unsigned long feature);
 void sbi_hart_get_features_str(struct sbi_scratch *scratch,
@@ -0,0 +1,51 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_LOG_H__
+#define __SBI_LOG_H__
+
+#include <sbi/sbi_console.h>
+
+#define SBI_LOG_NONE	0
+#define SBI_LOG_ERR	1
+#define SBI_LOG_WARN	2
+#define SBI_LOG_INFO	3
+#define SBI_LOG_DEBUG	4
+
+/*
+ * Compile time threshold of each subsystem. Messages above it are dead
+ * code and disappear together with their arguments. Override from the
+ * command line, e.g. make SBI_LOG_LEVEL_EBI=4.
+ */
+#ifndef SBI_LOG_LEVEL_EBI
+#define SBI_LOG_LEVEL_EBI	SBI_LOG_INFO
+#endif
+
+#ifndef SBI_LOG_LEVEL_ECALL
+#define SBI_LOG_LEVEL_ECALL	SBI_LOG_WARN
+#endif
+
+/* Run time threshold, applied to whatever survived the compile time one */
+extern int sbi_log_level;
+
+void sbi_log_set_level(int level);
+
+#define sbi_log(subsys, level, fmt, ...)				\
+	do {								\
+		if ((level) <= SBI_LOG_LEVEL_##subsys &&		\
+		    (level) <= sbi_log_level)				\
+			sbi_printf(fmt, ##__VA_ARGS__);			\
+	} while (0)
+
+#define ebi_err(fmt, ...)	sbi_log(EBI, SBI_LOG_ERR, fmt, ##__VA_ARGS__)
+#define ebi_warn(fmt, ...)	sbi_log(EBI, SBI_LOG_WARN, fmt, ##__VA_ARGS__)
+#define ebi_info(fmt, ...)	sbi_log(EBI, SBI_LOG_INFO, fmt, ##__VA_ARGS__)
+#define ebi_debug(fmt, ...)	sbi_log(EBI, SBI_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#define ecall_err(fmt, ...)	sbi_log(ECALL, SBI_LOG_ERR, fmt, ##__VA_ARGS__)
+#define ecall_warn(fmt, ...)	sbi_log(ECALL, SBI_LOG_WARN, fmt, ##__VA_ARGS__)
+#define ecall_info(fmt, ...)	sbi_log(ECALL, SBI_LOG_INFO, fmt, ##__VA_ARGS__)
+#define ecall_debug(fmt, ...)	sbi_log(ECALL, SBI_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_RVV_H__
+#define __SBI_RVV_H__
+
+#include <sbi/sbi_types.h>
+
+/*
+ * Vector (RVV 1.0) kernels behind sbi_memcpy(), sbi_memset() and
+ * sbi_memcmp(), built with FW_RVV=y and used on harts whose misa has V.
+ *
+ * The vector registers belong to whatever M-mode interrupted. If its
+ * mstatus.VS is Off the kernels use them freely and switch VS back off;
+ * otherwise the registers the kernel uses are saved to a per hart scratch
+ * area and restored around it, so only copies big enough to pay for that
+ * go through it.
+ */
+
+/* Below this the scalar word loops are as fast */
+#define SBI_RVV_MIN_SIZE 256
+/* Minimum size when the interrupted context's registers must be saved */
+#define SBI_RVV_MIN_SAVE_SIZE 8192
+/* Save area for v0-v8 up to VLEN 256, 9 x 32 bytes */
+#define SBI_RVV_SAVE_MAX 288
+
+#ifdef FW_RVV
+
+void sbi_rvv_init(void);
+bool sbi_rvv_set_enabled(bool enable);
+bool __sbi_rvv_memcpy(void *dest, const void *src, size_t count);
+bool __sbi_rvv_memset(void *s, int c, size_t count);
+bool __sbi_rvv_memcmp(const void *s1, const void *s2, size_t count,
+		      int *ret);
+
+/* Each returns FALSE when the caller has to do the work in scalar code */
+static inline bool sbi_rvv_memcpy(void *dest, const void *src, size_t count)
+{
+	return count >= SBI_RVV_MIN_SIZE && __sbi_rvv_memcpy(dest, src, count);
+}
+
+static inline bool sbi_rvv_memset(void *s, int c, size_t count)
+{
+	return count >= SBI_RVV_MIN_SIZE && __sbi_rvv_memset(s, c, count);
+}
+
+static inline bool sbi_rvv_memcmp(const void *s1, const void *s2,
+				  size_t count, int *ret)
+{
+	return count >= SBI_RVV_MIN_SIZE &&
+	       __sbi_rvv_memcmp(s1, s2, count, ret);
+}
+
+#else
+
+static inline void sbi_rvv_init(void)
+{
+}
+
+static inline bool sbi_rvv_set_enabled(bool enable)
+{
+	return FALSE;
+}
+
+static inline bool sbi_rvv_memcpy(void *dest, const void *src, size_t count)
+{
+	return FALSE;
+}
+
+static inline bool sbi_rvv_memset(void *s, int c, size_t count)
+{
+	return FALSE;
+}
+
+static inline bool sbi_rvv_memcmp(const void *s1, const void *s2,
+				  size_t count, int *ret)
+{
+	return FALSE;
+}
+
+#endif
+
+#endif
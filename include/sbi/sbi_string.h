@@ -35,6 +35,8 @@ char *sbi_strrchr(const char *s, int c);
 
 void *sbi_memset(void *s, int c, size_t count);
 
+void *sbi_memzero(void *s, size_t count);
+
 void *sbi_memcpy(void *dest, const void *src, size_t count);
 
 void *sbi_memmove(void *dest, const void *src, size_t count);
@@ -50,6 +50,15 @@ void sbi_timer_event_start(u64 next_event);
 /** Process timer event for current HART */
 void sbi_timer_process(void);
 
+/** Compare value of the pending S-mode timer event, -1 if there is none */
+u64 sbi_timer_get_event(void);
+
+/**
+ * Program the compare value of current HART for M-mode's own use, or
+ * disarm it with -1. The S-mode event is neither delivered nor dropped.
+ */
+void sbi_timer_set_compare(u64 value);
+
 /** Get current timer device */
 const struct sbi_timer_device *sbi_timer_get_device(void);
 
@@ -38,4 +38,10 @@ DECLARE_UNPRIVILEGED_LOAD_FUNCTION(ulong)
 
 ulong sbi_get_insn(ulong mepc, struct sbi_trap_info *trap);
 
+int sbi_copy_from_user(void *dst, const void *src, size_t size,
+		       struct sbi_trap_info *trap);
+
+int sbi_copy_to_user(void *dst, const void *src, size_t size,
+		     struct sbi_trap_info *trap);
+
 #endif
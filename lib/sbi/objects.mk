@@ -13,6 +13,7 @@ libsbi-objs-y += riscv_hardfp.o
 libsbi-objs-y += riscv_locks.o
 
 libsbi-objs-y += sbi_bitmap.o
+libsbi-objs-$(FW_BENCH) += sbi_bench.o
 libsbi-objs-y += sbi_bitops.o
 libsbi-objs-y += sbi_console.o
 libsbi-objs-y += sbi_domain.o
@@ -25,6 +26,9 @@ libsbi-objs-y += sbi_ecall_replace.o
 libsbi-objs-y += sbi_ecall_vendor.o
 libsbi-objs-y += sbi_ecall_ebi.o
 libsbi-objs-y += sbi_ecall_ebi_enclave.o
+libsbi-objs-y += sbi_ecall_ebi_measure.o
+libsbi-objs-y += sbi_ecall_ebi_mem.o
+libsbi-objs-y += sbi_ecall_ebi_pool.o
 libsbi-objs-y += sbi_emulate_csr.o
 libsbi-objs-y += sbi_fifo.o
 libsbi-objs-y += sbi_hart.o
@@ -37,6 +41,7 @@ libsbi-objs-y += sbi_ipi.o
 libsbi-objs-y += sbi_misaligned_ldst.o
 libsbi-objs-y += sbi_platform.o
 libsbi-objs-y += sbi_pmu.o
+libsbi-objs-y += sbi_rvv.o
 libsbi-objs-y += sbi_scratch.o
 libsbi-objs-y += sbi_string.o
 libsbi-objs-y += sbi_system.o
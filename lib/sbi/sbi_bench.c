@@ -0,0 +1,234 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Boot time micro-benchmarks for the firmware memory primitives.
+ *
+ * Each primitive is timed with mcycle against a plain byte loop, which is
+ * what sbi_string.c used to do, over a few buffer sizes and alignments.
+ * With FW_RVV on a vector hart the vector kernels are timed as well.
+ * Buffers are borrowed from the enclave memory pool, so this has to run
+ * after sbi_ecall_init().
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/riscv_encoding.h>
+#include <sbi/sbi_bench.h>
+#include <sbi/sbi_console.h>
+#include <sbi/sbi_ecall_ebi_mem.h>
+#include <sbi/sbi_rvv.h>
+#include <sbi/sbi_string.h>
+
+#define BENCH_BUF_SIZE 0x11000
+#define BENCH_TOTAL_BYTES 0x100000
+#define BENCH_MIN_ITERS 4
+
+/* Keeps the compiler from turning the reference loops into library calls */
+#define bench_barrier() __asm__ __volatile__("" : : : "memory")
+
+static volatile int bench_sink;
+
+static void ref_memset(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+
+	while (n--) {
+		*d++ = 0x5a;
+		bench_barrier();
+	}
+}
+
+static void ref_memzero(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+
+	while (n--) {
+		*d++ = 0;
+		bench_barrier();
+	}
+}
+
+static void ref_memcpy(void *dst, const void *src, size_t n)
+{
+	char *d	      = dst;
+	const char *s = src;
+
+	while (n--) {
+		*d++ = *s++;
+		bench_barrier();
+	}
+}
+
+static void ref_memmove(void *dst, const void *src, size_t n)
+{
+	char *d	      = dst;
+	const char *s = src;
+
+	if (d <= s) {
+		ref_memcpy(dst, src, n);
+		return;
+	}
+	d += n;
+	s += n;
+	while (n--) {
+		*--d = *--s;
+		bench_barrier();
+	}
+}
+
+static void ref_memcmp(void *dst, const void *src, size_t n)
+{
+	const char *a = dst, *b = src;
+	int r	      = 0;
+
+	while (n--) {
+		r = *a++ - *b++;
+		if (r)
+			break;
+		bench_barrier();
+	}
+	bench_sink = r;
+}
+
+static void opt_memset(void *dst, const void *src, size_t n)
+{
+	sbi_memset(dst, 0x5a, n);
+}
+
+static void opt_memzero(void *dst, const void *src, size_t n)
+{
+	sbi_memzero(dst, n);
+}
+
+static void opt_memcpy(void *dst, const void *src, size_t n)
+{
+	sbi_memcpy(dst, src, n);
+}
+
+static void opt_memmove(void *dst, const void *src, size_t n)
+{
+	sbi_memmove(dst, src, n);
+}
+
+static void opt_memcmp(void *dst, const void *src, size_t n)
+{
+	bench_sink = sbi_memcmp(dst, src, n);
+}
+
+struct bench_op {
+	const char *name;
+	void (*ref)(void *dst, const void *src, size_t n);
+	void (*opt)(void *dst, const void *src, size_t n);
+	/* Source offset from the destination for overlapping ops, else 0 */
+	size_t overlap;
+};
+
+static const struct bench_op bench_ops[] = {
+	{ "memset", ref_memset, opt_memset, 0 },
+	{ "memzero", ref_memzero, opt_memzero, 0 },
+	{ "memcpy", ref_memcpy, opt_memcpy, 0 },
+	{ "memmove", ref_memmove, opt_memmove, 256 },
+	{ "memcmp", ref_memcmp, opt_memcmp, 0 },
+};
+
+static const size_t bench_sizes[] = { 64, 4096, 65536 };
+
+static unsigned long bench_time(void (*fn)(void *, const void *, size_t),
+				void *dst, const void *src, size_t n,
+				unsigned long iters)
+{
+	unsigned long i, start;
+
+	/* Warm the caches so the first size does not pay for it */
+	fn(dst, src, n);
+
+	start = csr_read(CSR_MCYCLE);
+	for (i = 0; i < iters; i++)
+		fn(dst, src, n);
+	return csr_read(CSR_MCYCLE) - start;
+}
+
+void sbi_bench_report(const char *name, size_t bytes, unsigned long cycles)
+{
+	unsigned long rate;
+
+	if (!cycles)
+		cycles = 1;
+	rate = (bytes * 100) / cycles;
+	sbi_printf("[BENCH] %-32s %4lu.%02lu B/cycle\n", name, rate / 100,
+		   rate % 100);
+}
+
+static void bench_one(const struct bench_op *op, char *a, char *b,
+		      size_t n, bool misaligned)
+{
+	unsigned long iters, ref, opt, vec = 0;
+	bool rvv;
+	char name[40];
+	char *dst, *src;
+
+	iters = BENCH_TOTAL_BYTES / n;
+	if (iters < BENCH_MIN_ITERS)
+		iters = BENCH_MIN_ITERS;
+
+	if (op->overlap) {
+		/* Move up within one buffer, through the backward path */
+		src = a + (misaligned ? 1 : 0);
+		dst = src + op->overlap + (misaligned ? 2 : 0);
+	} else {
+		dst = a + (misaligned ? 3 : 0);
+		src = b + (misaligned ? 1 : 0);
+		/* memcmp has to walk the whole buffer to be comparable */
+		sbi_memset(dst, 0x5a, n);
+		sbi_memset(src, 0x5a, n);
+	}
+
+	/* The word row is the scalar code, vector kernels get their own row */
+	rvv = sbi_rvv_set_enabled(FALSE);
+	ref = bench_time(op->ref, dst, src, n, iters);
+	opt = bench_time(op->opt, dst, src, n, iters);
+	if (rvv) {
+		sbi_rvv_set_enabled(TRUE);
+		vec = bench_time(op->opt, dst, src, n, iters);
+	}
+
+	sbi_snprintf(name, sizeof(name), "%s %lu %s byte", op->name,
+		     (unsigned long)n, misaligned ? "unaligned" : "aligned");
+	sbi_bench_report(name, n * iters, ref);
+	sbi_snprintf(name, sizeof(name), "%s %lu %s word", op->name,
+		     (unsigned long)n, misaligned ? "unaligned" : "aligned");
+	sbi_bench_report(name, n * iters, opt);
+	if (rvv) {
+		sbi_snprintf(name, sizeof(name), "%s %lu %s rvv", op->name,
+			     (unsigned long)n,
+			     misaligned ? "unaligned" : "aligned");
+		sbi_bench_report(name, n * iters, vec);
+	}
+}
+
+void sbi_bench_run(void)
+{
+	uintptr_t a, b;
+	size_t i, j;
+
+	a = emem_alloc(BENCH_BUF_SIZE);
+	b = emem_alloc(BENCH_BUF_SIZE);
+	if (!a || !b) {
+		sbi_printf("[BENCH] cannot allocate benchmark buffers\n");
+		goto out;
+	}
+
+	for (i = 0; i < array_size(bench_ops); i++) {
+		for (j = 0; j < array_size(bench_sizes); j++) {
+			bench_one(&bench_ops[i], (char *)a, (char *)b,
+				  bench_sizes[j], FALSE);
+			bench_one(&bench_ops[i], (char *)a, (char *)b,
+				  bench_sizes[j], TRUE);
+		}
+	}
+
+out:
+	if (a)
+		emem_free(a, BENCH_BUF_SIZE, FALSE);
+	if (b)
+		emem_free(b, BENCH_BUF_SIZE, FALSE);
+}
@@ -9,12 +9,15 @@
 
 #include <sbi/riscv_locks.h>
 #include <sbi/sbi_console.h>
+#include <sbi/sbi_log.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_scratch.h>
 
 static const struct sbi_console_device *console_dev = NULL;
 static spinlock_t console_out_lock	       = SPIN_LOCK_INITIALIZER;
 
+int sbi_log_level = SBI_LOG_INFO;
+
 bool sbi_isprintable(char c)
 {
 	if (((31 < c) && (c < 127)) || (c == '\f') || (c == '\r') ||
@@ -407,7 +410,15 @@ void sbi_console_set_device(const struct sbi_console_device *dev)
 	console_dev = dev;
 }
 
+void sbi_log_set_level(int level)
+{
+	sbi_log_level = level;
+}
+
 int sbi_console_init(struct sbi_scratch *scratch)
 {
+	if (scratch->options & SBI_SCRATCH_DEBUG_PRINTS)
+		sbi_log_set_level(SBI_LOG_DEBUG);
+
 	return sbi_platform_console_init(sbi_platform_ptr(scratch));
 }
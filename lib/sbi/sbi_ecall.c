@@ -11,6 +11,8 @@
 #include <sbi/sbi_ecall.h>
 #include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_error.h>
+#include <sbi/sbi_log.h>
+#include <sbi/sbi_scratch.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/riscv_encoding.h>
 #include <sbi/riscv_asm.h>
@@ -40,24 +42,116 @@ void sbi_ecall_set_impid(unsigned long impid)
 
 static SBI_LIST_HEAD(ecall_exts_list);
 
-struct sbi_ecall_extension *sbi_ecall_find_extension(unsigned long extid)
+/*
+ * Dispatch tables, rebuilt from ecall_exts_list whenever an extension is
+ * registered or unregistered. Single ID extensions sit in a small open
+ * addressed hash, extid_start..extid_end spans in a range table that is
+ * only scanned when the hash misses. Registration happens on the cold
+ * boot hart before any other hart takes an ecall.
+ */
+#define ECALL_HASH_BITS 5
+#define ECALL_HASH_SIZE (1U << ECALL_HASH_BITS)
+#define ECALL_RANGE_MAX 8
+
+static struct sbi_ecall_extension *ecall_hash[ECALL_HASH_SIZE];
+static struct sbi_ecall_extension *ecall_ranges[ECALL_RANGE_MAX];
+static unsigned int ecall_nranges;
+
+/* Scratch offset of the extension of the last ecall each hart dispatched */
+static unsigned long ecall_last_hit_off;
+
+static inline unsigned int ecall_hash_index(unsigned long extid)
+{
+	return ((u32)extid * 0x9e3779b1U) >> (32 - ECALL_HASH_BITS);
+}
+
+static inline bool ecall_ext_match(struct sbi_ecall_extension *t,
+				   unsigned long extid)
+{
+	return t->extid_start <= extid && extid <= t->extid_end;
+}
+
+static int ecall_table_build(void)
 {
-	struct sbi_ecall_extension *t, *ret = NULL;
+	struct sbi_ecall_extension *t;
+	struct sbi_scratch *scratch;
+	unsigned int i, h;
+
+	for (i = 0; i < ECALL_HASH_SIZE; i++)
+		ecall_hash[i] = NULL;
+	for (i = 0; ecall_last_hit_off && i <= sbi_scratch_last_hartid(); i++) {
+		scratch = sbi_hartid_to_scratch(i);
+		if (scratch)
+			*(struct sbi_ecall_extension **)sbi_scratch_offset_ptr(
+				scratch, ecall_last_hit_off) = NULL;
+	}
+	ecall_nranges = 0;
 
 	sbi_list_for_each_entry(t, &ecall_exts_list, head)
 	{
-		if (t->extid_start <= extid && extid <= t->extid_end) {
-			ret = t;
-			break;
+		if (t->extid_start != t->extid_end) {
+			if (ecall_nranges == ECALL_RANGE_MAX)
+				return SBI_ENOSPC;
+			ecall_ranges[ecall_nranges++] = t;
+			continue;
+		}
+
+		h = ecall_hash_index(t->extid_start);
+		for (i = 0; i < ECALL_HASH_SIZE; i++) {
+			if (!ecall_hash[(h + i) & (ECALL_HASH_SIZE - 1)])
+				break;
 		}
+		if (i == ECALL_HASH_SIZE)
+			return SBI_ENOSPC;
+		ecall_hash[(h + i) & (ECALL_HASH_SIZE - 1)] = t;
 	}
 
-	return ret;
+	return 0;
+}
+
+struct sbi_ecall_extension *sbi_ecall_find_extension(unsigned long extid)
+{
+	struct sbi_ecall_extension *t;
+	unsigned int i, h = ecall_hash_index(extid);
+
+	for (i = 0; i < ECALL_HASH_SIZE; i++) {
+		t = ecall_hash[(h + i) & (ECALL_HASH_SIZE - 1)];
+		if (!t)
+			break;
+		if (t->extid_start == extid)
+			return t;
+	}
+
+	for (i = 0; i < ecall_nranges; i++) {
+		if (ecall_ext_match(ecall_ranges[i], extid))
+			return ecall_ranges[i];
+	}
+
+	return NULL;
+}
+
+/* Runs of ecalls to one extension (timer, IPI) skip the table walk */
+static struct sbi_ecall_extension *ecall_find_cached(unsigned long extid)
+{
+	struct sbi_ecall_extension **last, *t;
+
+	if (!ecall_last_hit_off)
+		return sbi_ecall_find_extension(extid);
+	last = sbi_scratch_thishart_offset_ptr(ecall_last_hit_off);
+	t    = *last;
+	if (t && ecall_ext_match(t, extid))
+		return t;
+
+	t = sbi_ecall_find_extension(extid);
+	if (t)
+		*last = t;
+	return t;
 }
 
 int sbi_ecall_register_extension(struct sbi_ecall_extension *ext)
 {
 	struct sbi_ecall_extension *t;
+	int ret;
 
 	if (!ext || (ext->extid_end < ext->extid_start) || !ext->handle)
 		return SBI_EINVAL;
@@ -75,7 +169,13 @@ int sbi_ecall_register_extension(struct sbi_ecall_extension *ext)
 	SBI_INIT_LIST_HEAD(&ext->head);
 	sbi_list_add_tail(&ext->head, &ecall_exts_list);
 
-	return 0;
+	ret = ecall_table_build();
+	if (ret) {
+		sbi_list_del_init(&ext->head);
+		ecall_table_build();
+	}
+
+	return ret;
 }
 
 void sbi_ecall_unregister_extension(struct sbi_ecall_extension *ext)
@@ -94,8 +194,10 @@ void sbi_ecall_unregister_extension(struct sbi_ecall_extension *ext)
 		}
 	}
 
-	if (found)
+	if (found) {
 		sbi_list_del_init(&ext->head);
+		ecall_table_build();
+	}
 }
 
 int sbi_ecall_handler(struct sbi_trap_regs *regs)
@@ -108,11 +210,9 @@ int sbi_ecall_handler(struct sbi_trap_regs *regs)
 	unsigned long out_val	   = 0;
 	bool is_0_1_spec	   = 0;
 
-	if (extension_id == SBI_EXT_EBI) {
-		sbi_printf(
-			"[sbi_ecall_handler] Calling EBI with function ID=%lu\n",
-			func_id);
-	}
+	if (extension_id == SBI_EXT_EBI)
+		ecall_debug("[sbi_ecall_handler] Calling EBI with function ID=%lu\n",
+			    func_id);
 
 	ulong mcause	= csr_read(CSR_MCAUSE);
 	ulong mtval	= csr_read(CSR_MTVAL);
@@ -130,7 +230,7 @@ int sbi_ecall_handler(struct sbi_trap_regs *regs)
 		return 0;
 	}
 
-	ext = sbi_ecall_find_extension(extension_id);
+	ext = ecall_find_cached(extension_id);
 	if (ext && ext->handle) {
 		ret = ext->handle(extension_id, func_id, regs, &out_val, &trap);
 		if (extension_id >= SBI_EXT_0_1_SET_TIMER &&
@@ -140,18 +240,17 @@ int sbi_ecall_handler(struct sbi_trap_regs *regs)
 		ret = SBI_ENOTSUPP;
 	}
 
-	if (extension_id == SBI_EXT_EBI) {
-		sbi_printf("[sbi_ecall_handler] EBI ret = %d\n", ret);
-	}
+	if (extension_id == SBI_EXT_EBI)
+		ecall_debug("[sbi_ecall_handler] EBI ret = %d\n", ret);
 
 	if (ret == SBI_ETRAP) {
 		trap.epc = regs->mepc;
 		sbi_trap_redirect(regs, &trap);
 	} else {
 		if (ret < SBI_LAST_ERR) {
-			sbi_printf("%s: Invalid error %d for ext=0x%lx "
-				   "func=0x%lx\n",
-				   __func__, ret, extension_id, func_id);
+			ecall_err("%s: Invalid error %d for ext=0x%lx "
+				  "func=0x%lx\n",
+				  __func__, ret, extension_id, func_id);
 			ret = SBI_ERR_FAILED;
 		}
 
@@ -164,9 +263,14 @@ int sbi_ecall_handler(struct sbi_trap_regs *regs)
 		 * case should be handled differently.
 		 */
 		regs->mepc += 4;
-		regs->a0 = ret;
-		if (!is_0_1_spec && extension_id != SBI_EXT_EBI)
-			regs->a1 = out_val;
+		if (extension_id == SBI_EXT_EBI) {
+			/* Single return value, regs may belong to another context */
+			regs->a0 = ret ? ret : out_val;
+		} else {
+			regs->a0 = ret;
+			if (!is_0_1_spec)
+				regs->a1 = out_val;
+		}
 	}
 
 	return 0;
@@ -176,7 +280,11 @@ int sbi_ecall_init(void)
 {
 	int ret;
 
-	/* The order of below registrations is performance optimized */
+	ecall_last_hit_off =
+		sbi_scratch_alloc_offset(sizeof(struct sbi_ecall_extension *));
+	if (!ecall_last_hit_off)
+		return SBI_ENOMEM;
+
 	ret = sbi_ecall_register_extension(&ecall_time);
 	if (ret)
 		return ret;
@@ -206,8 +314,8 @@ int sbi_ecall_init(void)
 		return ret;
 	ret = sbi_ecall_register_extension(&ecall_ebi);
 	init_enclaves();
-	sbi_printf("############### init ecall_ebi successfully\n");
-	sbi_printf("ecall_ebi: %p\n", ecall_ebi.handle);
+	ebi_info("[EBI] ecall extension registered\n");
+	ebi_debug("[EBI] ecall_ebi: %p\n", ecall_ebi.handle);
 	if (ret)
 		return ret;
 	return 0;
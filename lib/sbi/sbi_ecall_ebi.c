@@ -1,63 +1,176 @@
 #include <sbi/sbi_ecall.h>
 #include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_ecall_ebi_enclave.h>
+#include <sbi/sbi_ecall_ebi_pool.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_version.h>
 #include <sbi/riscv_asm.h>
-#include <sbi/sbi_console.h>
+#include <sbi/sbi_log.h>
 
 extern char _base_start, _base_end;
 extern char _enclave_start, _enclave_end;
 
+/* a0 picks the counter, a1 the driver for the per driver ones */
+static int ebi_query(unsigned long which, unsigned long arg,
+		     unsigned long *out_val)
+{
+	struct enclave_pool_stats pool;
+	struct enclave_drv_stats drv;
+	unsigned long flushes, switches;
+
+	if (which >= SBI_EXT_EBI_STAT_DRV_ACQUIRE &&
+	    which <= SBI_EXT_EBI_STAT_DRV_TIMEOUT) {
+		if (arg >= MAX_DRV)
+			return SBI_EINVAL;
+		enclave_drv_get_stats(arg, &drv);
+	}
+	enclave_pool_get_stats(&pool);
+	enclave_tlb_get_stats(&flushes, &switches);
+	switch (which) {
+	case SBI_EXT_EBI_STAT_POOL_HIT:
+		*out_val = pool.hits;
+		break;
+	case SBI_EXT_EBI_STAT_POOL_MISS:
+		*out_val = pool.misses;
+		break;
+	case SBI_EXT_EBI_STAT_POOL_REFILL:
+		*out_val = pool.refills;
+		break;
+	case SBI_EXT_EBI_STAT_POOL_READY:
+		*out_val = pool.ready;
+		break;
+	case SBI_EXT_EBI_STAT_TLB_FLUSH:
+		*out_val = flushes;
+		break;
+	case SBI_EXT_EBI_STAT_SWITCH:
+		*out_val = switches;
+		break;
+	case SBI_EXT_EBI_STAT_DRV_ACQUIRE:
+		*out_val = drv.acquires;
+		break;
+	case SBI_EXT_EBI_STAT_DRV_CONTEND:
+		*out_val = drv.contended;
+		break;
+	case SBI_EXT_EBI_STAT_DRV_HANDOFF:
+		*out_val = drv.handoffs;
+		break;
+	case SBI_EXT_EBI_STAT_DRV_TIMEOUT:
+		*out_val = drv.timeouts;
+		break;
+	default:
+		return SBI_EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Every EBI call returns a single value in a0: the handler puts it in
+ * out_val and returns 0, or returns EBI_ERROR. Calls that switch between
+ * host and enclave rewrite regs with the context being switched to.
+ */
 static int sbi_ecall_ebi_handler(unsigned long extid, unsigned long funcid,
 				 const struct sbi_trap_regs *regs,
 				 unsigned long *out_val,
 				 struct sbi_trap_info *out_trap)
 {
-	int ret		   = 0;
+	uintptr_t ret;
 	unsigned long core = csr_read(
 		mhartid); // TODO(haonan): needs to verify this value is the core id;
 	ulong mepc = csr_read(CSR_MEPC);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdiscarded-qualifiers"
+	struct sbi_trap_regs *ctx = regs;
+#pragma GCC diagnostic pop
 
 	switch (funcid) {
 	case SBI_EXT_EBI_CREATE:
-		sbi_printf("[sbi_ecall_ebi_handler] SBI_EXT_EBI_CREATE\n");
-		sbi_printf(
+		ebi_debug("[sbi_ecall_ebi_handler] SBI_EXT_EBI_CREATE\n");
+		ebi_debug(
 			"[sbi_ecall_ebi_handler] extid = %lu, funcid = 0x%lx, args[0] = 0x%lx, args[1] = 0x%lx, core = %lu\n",
 			extid, funcid, regs->a0, regs->a1, core);
-		sbi_printf(
+		ebi_debug(
 			"[sbi_ecall_ebi_handler] _base_start @ %p, _base_end @ %p\n",
 			&_base_start, &_base_end);
-		sbi_printf(
+		ebi_debug(
 			"[sbi_ecall_ebi_handler] _enclave_start @ %p, _enclave_end @ %p\n",
 			&_enclave_start, &_enclave_end);
-		// sbi_printf("handle syscall %d %lx %lx at core %ld\n", (int)extid, args[0], args[1], core);
-		// sbi_printf("Enclave Created: %lx %lx %lx\n", args[0], args[1], args[2]);
-		// sbi_printf("base_start @ %p\n", &_base_start);
-		// regs[A0_INDEX] = create_enclave(regs, mepc);
-		//write_csr(mepc, mepc + 4); // Avoid repeatedly enter the trap handler
 		ret = create_enclave(regs, mepc);
-		sbi_printf("[sbi_ecall_ebi_handler] after create_enclave\n");
-		return ret;
+		ebi_debug("[sbi_ecall_ebi_handler] after create_enclave\n");
+		if (ret == EBI_ERROR)
+			return EBI_ERROR;
+		*out_val = ret;
+		return 0;
 
 	case SBI_EXT_EBI_ENTER:
-#pragma GCC diagnostic ignored "-Wdiscarded-qualifiers"
-#pragma GCC diagnostic push
-		sbi_printf("[sbi_ecall_ebi_handler] enter\n");
-		enter_enclave(regs, mepc);
-		sbi_printf("[sbi_ecall_ebi_handler] back from enter_enclave\n");
-		sbi_printf("[sbi_ecall_ebi_handler] into->pa: 0x%lx\n",
-			   regs->a1);
-		return ret;
-#pragma GCC diagnostic pop
+		ebi_debug("[sbi_ecall_ebi_handler] enter\n");
+		ret = enter_enclave(ctx, mepc);
+		ebi_debug("[sbi_ecall_ebi_handler] back from enter_enclave\n");
+		ebi_debug("[sbi_ecall_ebi_handler] into->pa: 0x%lx\n",
+			  regs->a1);
+		break;
+
 	case SBI_EXT_EBI_EXIT:
-		sbi_printf("[sbi_ecall_ebi_handler] exit\n");
-		exit_enclave(regs);
-		return ret;
+		ebi_debug("[sbi_ecall_ebi_handler] exit\n");
+		ret = exit_enclave(ctx);
+		break;
+
+	case SBI_EXT_EBI_PAUSE:
+		ebi_debug("[sbi_ecall_ebi_handler] pause\n");
+		ret = pause_enclave(ctx, mepc);
+		break;
+
+	case SBI_EXT_EBI_RESUME:
+		ebi_debug("[sbi_ecall_ebi_handler] resume\n");
+		ret = resume_enclave(ctx, mepc);
+		break;
+
+	case SBI_EXT_EBI_FETCH:
+		ebi_debug("[sbi_ecall_ebi_handler] fetch\n");
+		if (fetch_driver(regs) != EBI_OK)
+			return EBI_ERROR;
+		*out_val = 0;
+		return 0;
+
+	case SBI_EXT_EBI_RELEASE:
+		ebi_debug("[sbi_ecall_ebi_handler] release\n");
+		if (release_driver(regs) != EBI_OK)
+			return EBI_ERROR;
+		*out_val = 0;
+		return 0;
+
+	case SBI_EXT_EBI_RING:
+		ebi_debug("[sbi_ecall_ebi_handler] ring\n");
+		if (attach_ring(regs) != EBI_OK)
+			return EBI_ERROR;
+		*out_val = 0;
+		return 0;
+
+	case SBI_EXT_EBI_SHARE:
+		ebi_debug("[sbi_ecall_ebi_handler] share\n");
+		if (share_window(regs) != EBI_OK)
+			return EBI_ERROR;
+		*out_val = 0;
+		return 0;
+
+	case SBI_EXT_EBI_MEASURE:
+		ebi_debug("[sbi_ecall_ebi_handler] measure\n");
+		if (measure_enclave(regs) != EBI_OK)
+			return EBI_ERROR;
+		*out_val = 0;
+		return 0;
+
+	case SBI_EXT_EBI_QUERY:
+		return ebi_query(regs->a0, regs->a1, out_val);
+
+	default:
+		return SBI_ENOTSUPP;
 	}
 
-	return ret;
+	if (ret != EBI_OK)
+		return EBI_ERROR;
+	*out_val = regs->a0;
+	return 0;
 }
 
 struct sbi_ecall_extension ecall_ebi = {
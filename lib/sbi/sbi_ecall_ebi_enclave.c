@@ -1,13 +1,22 @@
 #include <sbi/riscv_encoding.h>
 #include <sbi/sbi_ecall_ebi_enclave.h>
+#include <sbi/sbi_ecall_ebi_measure.h>
+#include <sbi/sbi_ecall_ebi_mem.h>
+#include <sbi/sbi_ecall_ebi_pool.h>
 #include <sbi/sbi_console.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_hart.h>
+#include <sbi/sbi_hartmask.h>
+#include <sbi/sbi_hsm.h>
+#include <sbi/sbi_ipi.h>
+#include <sbi/sbi_log.h>
 #include <sbi/riscv_asm.h>
+#include <sbi/sbi_scratch.h>
 #include <sbi/sbi_string.h>
+#include <sbi/sbi_timer.h>
 #include <sbi/sbi_trap.h>
-
-#define MAX_PAGE 8192
-static enclave_page_t pages[MAX_PAGE];
-static size_t max_pages;
+#include <sbi/sbi_unpriv.h>
 
 void poweroff(uint16_t code)
 {
@@ -61,141 +70,234 @@ long atol(const char *str)
 	return sign ? -res : res;
 }
 
-static inline uint32_t load_uint32_t(const uint32_t *addr, uintptr_t mepc)
+static inline void flush_tlb()
 {
-	register uintptr_t __mepc asm("a2") = mepc;
-	register uintptr_t __mstatus asm("a3");
-	uint32_t val;
-	asm("csrrs %0, mstatus, %3\n"
-	    "lw %1, %2\n"
-	    "csrw mstatus, %0"
-	    : "+&r"(__mstatus), "=&r"(val)
-	    : "m"(*addr), "r"(MSTATUS_MPRV), "r"(__mepc));
-	return val;
+	asm volatile("sfence.vma");
+}
+
+void enclave_mem_init()
+{
+	uintptr_t page_start, page_end;
+	page_start		   = (uintptr_t)&_enclave_start;
+	page_end		   = (uintptr_t)&_enclave_end;
+	size_t enclave_memory_size = page_end - page_start;
+	assert(enclave_memory_size % EPAGE_SIZE == 0);
+
+	// ensure we can keep track of all memory.
+	if (emem_init(page_start, enclave_memory_size))
+		die("cannot track enclave memory of size 0x%lx",
+		    enclave_memory_size);
+	emem_scrub_init();
+	emem_dump_stats();
 }
 
-static inline uint8_t load_uint8_t(const uint8_t *addr, uintptr_t mepc)
+uintptr_t enclave_mem_alloc(enclave_context *context, size_t enclave_size)
 {
-	register uintptr_t __mepc asm("a2") = mepc;
-	register uintptr_t __mstatus asm("a3");
-	uint8_t val;
-	asm("csrrs %0, mstatus, %3\n"
-	    "lbu %1, %2\n"
-	    "csrw mstatus, %0"
-	    : "+&r"(__mstatus), "=&r"(val)
-	    : "m"(*addr), "r"(MSTATUS_MPRV), "r"(__mepc));
-	return val;
+	uintptr_t pa;
+	assert((enclave_size & MASK(EPAGE_SHIFT)) ==
+	       0); // at least one page should be allocated
+
+	pa = emem_alloc(enclave_size);
+	if (!pa) {
+		ebi_err("[enclave_mem_alloc] alloc enclave memory failed\n");
+		emem_dump_stats();
+		return EBI_ERROR;
+	}
+	/* Only pages not scrubbed on their last release need zeroing */
+	emem_zero(pa, enclave_size);
+
+	context->pa = pa;
+	ebi_debug("[enclave_mem_alloc] context->pa = %lx\n", context->pa);
+	context->mem_size = enclave_size;
+	return EBI_OK;
 }
 
-static inline void store_uint32_t(uint32_t *addr, uint32_t val, uintptr_t mepc)
+uintptr_t enclave_mem_free(enclave_context *context, bool clean)
 {
-	register uintptr_t __mepc asm("a2") = mepc;
-	register uintptr_t __mstatus asm("a3");
-	asm volatile("csrrs %0, mstatus, %3\n"
-		     "sw %1, %2\n"
-		     "csrw mstatus, %0"
-		     : "+&r"(__mstatus)
-		     : "r"(val), "m"(*addr), "r"(MSTATUS_MPRV), "r"(__mepc));
+	assert(context->mem_size % EPAGE_SIZE == 0);
+	emem_free(context->pa, context->mem_size, clean);
+	return EBI_OK;
 }
 
-static inline void flush_tlb()
+/*
+ * Enclave slots are carved out of the enclave memory pool at boot, sized so
+ * that every minimal enclave fitting in the pool has a slot. Each slot is
+ * guarded by its own lock; the host context a hart returns to on exit lives
+ * in that hart's scratch space, so every hart can run an enclave at once.
+ */
+static enclave_context *enclaves;
+static size_t num_enclaves;
+static unsigned long host_context_offset;
+
+static inline enclave_context *host_context(void)
 {
-	asm volatile("sfence.vma");
+	return sbi_scratch_thishart_offset_ptr(host_context_offset);
 }
 
-static inline uint64_t load_uint64_t(const uint64_t *addr, uintptr_t mepc)
+static inline enclave_context *get_enclave(uintptr_t id)
 {
-	return load_uint32_t((uint32_t *)addr, mepc) +
-	       ((uint64_t)load_uint32_t((uint32_t *)addr + 1, mepc) << 32);
+	return id < num_enclaves ? &enclaves[id] : NULL;
 }
 
-static inline void store_uint64_t(uint64_t *addr, uint64_t val, uintptr_t mepc)
+/*
+ * Every slot owns a fixed ASID from the top of the ASID space. When the
+ * host keeps out of that range, host and enclave translations can stay in
+ * the TLB across switches: a slot's ASID only has to be fenced when the
+ * slot is reused by a new enclave, and then only once on each hart that
+ * enters it. PMP checks cached in the TLB stay valid because a given ASID
+ * always runs under the same PMP setting.
+ *
+ * The range is known to be free when the firmware is built with
+ * EBI_ASID_RESERVED, or when the host runs with ASID 0 and so does not
+ * allocate ASIDs at all. A host that does may have non-global entries
+ * under an enclave's ASID for the same low VAs, so then the enclave ASID
+ * is fenced on every enter, and the enclave and host ASIDs on every leave.
+ * Without usable ASIDs every switch fences everything, as before.
+ */
+static unsigned long asid_bits;
+static bool asid_enabled;
+static atomic_t tlb_flushes  = ATOMIC_INITIALIZER(0);
+static atomic_t tlb_switches = ATOMIC_INITIALIZER(0);
+
+#if __riscv_xlen == 64
+#define SATP_ASID_MASK SATP64_ASID
+#define SATP_PPN_MASK SATP64_PPN
+#else
+#define SATP_ASID_MASK SATP32_ASID
+#define SATP_PPN_MASK SATP32_PPN
+#endif
+
+/*
+ * Host contexts are told apart by their root page table, which a process
+ * keeps wherever it is scheduled, rather than by hart.
+ */
+static inline uintptr_t host_owner(uintptr_t satp)
 {
-	store_uint32_t((uint32_t *)addr, val, mepc);
-	store_uint32_t((uint32_t *)addr + 1, val >> 32, mepc);
+	return satp & SATP_PPN_MASK;
 }
 
-void enclave_mem_init()
+/* Whether the calling host may drive context, with context->lock held */
+static inline bool host_owns(const enclave_context *context)
 {
-	uintptr_t page_start, page_end;
-	page_start		   = (uintptr_t)&_enclave_start;
-	page_end		   = (uintptr_t)&_enclave_end;
-	size_t enclave_memory_size = page_end - page_start;
-	assert(enclave_memory_size % EPAGE_SIZE == 0);
-	max_pages = enclave_memory_size / EPAGE_SIZE;
+	return context->owner == host_owner(csr_read(CSR_SATP));
+}
 
-	assert(max_pages <=
-	       MAX_PAGE); // ensure we can keep track of all memory.
-	sbi_memset(pages, 0, sizeof(enclave_page_t) * max_pages);
-	for (size_t i = 0; i < max_pages; i++) {
-		pages[i].pa	= page_start + i * EPAGE_SIZE;
-		pages[i].status = PAGE_FREE;
+static unsigned long tlb_probe_asid_bits(void)
+{
+	unsigned long satp = csr_read(CSR_SATP), asid, bits = 0;
+
+	/* Translation is not used in M-mode, any root will do */
+#if __riscv_xlen == 64
+	csr_write(CSR_SATP, (SATP_MODE_SV39 << SATP_MODE_SHIFT) | SATP64_ASID);
+#else
+	csr_write(CSR_SATP, SATP32_MODE | SATP32_ASID);
+#endif
+	asid = (csr_read(CSR_SATP) & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+	csr_write(CSR_SATP, satp);
+
+	while (asid) {
+		bits++;
+		asid >>= 1;
 	}
+	return bits;
 }
 
-uintptr_t enclave_mem_alloc(enclave_context *context, size_t enclave_size)
+static void tlb_flush_asid(uintptr_t asid)
 {
-	enclave_page_t page;
-	assert((enclave_size & MASK(EPAGE_SHIFT)) ==
-	       0); // at least one page should be allocated
-	size_t page_num = enclave_size >> EPAGE_SHIFT;
-	/* Look for available memory */
-	char ok		= 0;
-	size_t page_idx = 0;
-	for (size_t i = 0; i < max_pages; i++) {
-		page = pages[i];
-		if (page.status == PAGE_FREE) {
-			ok = 1;
-			for (size_t j = i + 1;
-			     j - i < page_num && j < max_pages; j++) {
-				page = pages[j];
-				if (page.status != PAGE_FREE) {
-					i  = j + 1;
-					ok = 0;
-					break;
-				}
-			}
-			if (ok) {
-				page_idx = i;
-				break;
-			}
-		}
+	asm volatile("sfence.vma x0, %0" : : "r"(asid) : "memory");
+}
+
+static inline uintptr_t tlb_host_asid(enclave_context *host)
+{
+	return (host->ns_satp & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+}
+
+/* TRUE if the host cannot have TLB entries under an enclave ASID */
+static bool tlb_asids_private(enclave_context *host)
+{
+#ifdef EBI_ASID_RESERVED
+	return TRUE;
+#else
+	return !tlb_host_asid(host);
+#endif
+}
+
+/* After switching satp from host to an enclave slot */
+static void tlb_enter(enclave_context *into, enclave_context *host)
+{
+	u32 hartid = current_hartid();
+	int stale;
+
+	atomic_add_return(&tlb_switches, 1);
+	if (!asid_enabled) {
+		flush_tlb();
+		atomic_add_return(&tlb_flushes, 1);
+		return;
 	}
-	if (!ok) {
-		sbi_printf("alloc enclave memory failed\n");
-		return EBI_ERROR;
+
+	spin_lock(&into->lock);
+	stale = sbi_hartmask_test_hart(hartid, &into->tlb_stale);
+	sbi_hartmask_clear_hart(hartid, &into->tlb_stale);
+	spin_unlock(&into->lock);
+	if (stale || !tlb_asids_private(host)) {
+		tlb_flush_asid(into->asid);
+		atomic_add_return(&tlb_flushes, 1);
 	}
-	/* Mark used pages */
-	for (size_t i = 0; i < page_num; i++) {
-		pages[page_idx + i].status = PAGE_USED;
-		sbi_memset((void *)pages[page_idx + i].pa, 0, EPAGE_SIZE);
+}
+
+/* After switching satp from an enclave slot back to host */
+static void tlb_leave(enclave_context *from, enclave_context *host)
+{
+	atomic_add_return(&tlb_switches, 1);
+	if (!asid_enabled) {
+		flush_tlb();
+		atomic_add_return(&tlb_flushes, 1);
+	} else if (!tlb_asids_private(host)) {
+		tlb_flush_asid(from->asid);
+		if (tlb_host_asid(host) != from->asid)
+			tlb_flush_asid(tlb_host_asid(host));
+		atomic_add_return(&tlb_flushes, 1);
 	}
+}
 
-	page	    = pages[page_idx];
-	context->pa = page.pa;
-	sbi_printf("[enclave_mem_alloc] context->pa = %lx\n", context->pa);
-	context->mem_size = enclave_size;
-	return EBI_OK;
+void enclave_tlb_get_stats(unsigned long *flushes, unsigned long *switches)
+{
+	*flushes  = atomic_read(&tlb_flushes);
+	*switches = atomic_read(&tlb_switches);
 }
 
-uintptr_t enclave_mem_free(enclave_context *context)
+/* TRUE if hartid is running its host rather than an enclave */
+bool enclave_host_idle(u32 hartid)
 {
-	assert(context->mem_size % EPAGE_SIZE == 0);
-	size_t page_nums = context->mem_size >> EPAGE_SHIFT;
+	enclave_context *host = sbi_scratch_offset_ptr(
+		sbi_hartid_to_scratch(hartid), host_context_offset);
 
-	uintptr_t start_page_index = (context->pa - pages[0].pa) >> EPAGE_SHIFT;
-	while (page_nums-- > 0) {
-		pages[start_page_index++].status = PAGE_FREE;
-	}
-	return EBI_OK;
+	return host->status == ENC_RUN;
 }
 
-#define NUM_ENCLAVE 2
-static enclave_context enclaves[NUM_ENCLAVE + 1];
+/*
+ * TRUE if hartid is parked: its host has suspended it through HSM and it
+ * is not inside an enclave. Work sent there by IPI takes no time from a
+ * running host or enclave.
+ */
+bool enclave_hart_idle(u32 hartid)
+{
+	return enclave_host_idle(hartid) &&
+	       sbi_hsm_hart_get_state(sbi_domain_thishart_ptr(), hartid) ==
+		       SBI_HSM_STATE_SUSPENDED;
+}
 
+/*
+ * Host: entries 0-1 deny the firmware and the enclave carve-out, 2-3 allow
+ * the rest. Enclave: 0-1 its own memory, 2-5 the memory outside DRAM,
+ * 6-7 its host call ring and 8-9 its shared window, if it has them.
+ * The other entries of pmpcfg2 are left as they are.
+ */
 void pmp_switch(enclave_context *context)
 {
 	uintptr_t p0 = 0, p1 = 0, p2 = 0, p3 = 0, p4 = 0, p5 = 0, cfg;
+	uintptr_t p6 = 0, p7 = 0, p8 = 0, p9 = 0;
+	uintptr_t cfg2 = csr_read(CSR_PMPCFG2) & ~0xffffUL;
 	if (context == NULL) {
 		// Switch to Linux
 		extern char _enclave_end;
@@ -216,6 +318,18 @@ void pmp_switch(enclave_context *context)
 		p4 = PHY_MEM_END >> PMP_SHIFT;
 		p5 = -1UL >> PMP_SHIFT;
 		cfg |= (uintptr_t)(PMP_A_TOR | PMP_R | PMP_W | PMP_X) << 40;
+		if (context->ring_size) {
+			p6 = context->ring_pa >> PMP_SHIFT;
+			p7 = (context->ring_pa + context->ring_size) >>
+			     PMP_SHIFT;
+			cfg |= (uintptr_t)(PMP_A_TOR | PMP_R | PMP_W) << 56;
+		}
+		if (context->share_size) {
+			p8 = context->share_pa >> PMP_SHIFT;
+			p9 = (context->share_pa + context->share_size) >>
+			     PMP_SHIFT;
+			cfg2 |= (PMP_A_TOR | PMP_R | PMP_W) << 8;
+		}
 	}
 	asm volatile("csrw pmpaddr0, %[p0]\n\t"
 		     "csrw pmpaddr1, %[p1]\n\t"
@@ -223,14 +337,20 @@ void pmp_switch(enclave_context *context)
 		     "csrw pmpaddr3, %[p3]\n\t"
 		     "csrw pmpaddr4, %[p4]\n\t"
 		     "csrw pmpaddr5, %[p5]\n\t"
-		     "csrw pmpcfg0, %[cfg]" ::[p0] "r"(p0),
+		     "csrw pmpaddr6, %[p6]\n\t"
+		     "csrw pmpaddr7, %[p7]\n\t"
+		     "csrw pmpaddr8, %[p8]\n\t"
+		     "csrw pmpaddr9, %[p9]\n\t"
+		     "csrw pmpcfg0, %[cfg]\n\t"
+		     "csrw pmpcfg2, %[cfg2]" ::[p0] "r"(p0),
 		     [p1] "r"(p1), [p2] "r"(p2), [p3] "r"(p3), [p4] "r"(p4),
-		     [p5] "r"(p5), [cfg] "r"(cfg));
+		     [p5] "r"(p5), [p6] "r"(p6), [p7] "r"(p7), [p8] "r"(p8),
+		     [p9] "r"(p9), [cfg] "r"(cfg), [cfg2] "r"(cfg2));
 }
 
 void save_umode_context(enclave_context *context, struct sbi_trap_regs *regs)
 {
-	sbi_printf("[save_umode_context] regs @ 0x%p\n", regs);
+	ebi_debug("[save_umode_context] regs @ 0x%p\n", regs);
 	sbi_memcpy(context->umode_context, regs, INTEGER_CONTEXT_SIZE);
 }
 
@@ -255,10 +375,10 @@ void save_csr_context(enclave_context *from, uintptr_t mepc,
 	from->ns_sscratch = csr_read(CSR_SSCRATCH);
 }
 
+/* Translations are fenced by the callers, see tlb_enter() */
 void restore_csr_context(enclave_context *into, struct sbi_trap_regs *regs)
 {
 	csr_write(CSR_SATP, into->ns_satp);
-	flush_tlb();
 
 	// csr_write(CSR_MEPC, into->ns_mepc);
 	// csr_write(CSR_MSTATUS, into->ns_mstatus);
@@ -282,7 +402,7 @@ void init_csr_context(enclave_context *context)
 	context->ns_mstatus = new_mstatus;
 
 	context->ns_sstatus = csr_read(CSR_SSTATUS) & ~(SSTATUS_SIE);
-	context->ns_mepc    = 0x0 + context->pa + EUSR_MEM_SIZE;
+	context->ns_mepc    = 0x0 + context->pa + context->usr_size;
 	// context->ns_medeleg = (csr_read(CSR_MEDELEG) | (1U << CAUSE_FETCH_ACCESS) | (1U << CAUSE_USER_ECALL)) & ~(1U << CAUSE_SUPERVISOR_ECALL);
 	context->ns_sscratch = 0;
 	context->ns_satp     = 0;
@@ -290,47 +410,277 @@ void init_csr_context(enclave_context *context)
 	context->ns_stvec    = 0;
 }
 
-/* Machine mode does not contains the necessary mapping, need to switch back to
- * user mode */
-void memcpy_from_user(uintptr_t uaddr, uintptr_t maddr, uintptr_t size,
-		      uintptr_t mepc)
+/*
+ * Machine mode does not contain the necessary mapping, so the copy goes
+ * through MPRV with the caller's translation. Returns EBI_ERROR if the
+ * user buffer faults part way.
+ */
+static uintptr_t copy_from_user(uintptr_t uaddr, uintptr_t maddr,
+				uintptr_t size)
 {
-	while (size > 0) {
-		/* 8 bytes per iter */
-		if (size >= 8) {
-			*(uint64_t *)maddr =
-				load_uint64_t((uint64_t *)uaddr, mepc);
-			maddr += 8;
-			uaddr += 8;
-			size -= 8;
-		} else {
-			*(uint8_t *)maddr =
-				load_uint8_t((uint8_t *)uaddr, mepc);
-			sbi_printf("%c\n", *(char *)maddr);
-			++maddr;
-			++uaddr;
-			size -= 1;
-		}
+	struct sbi_trap_info trap;
+
+	if (sbi_copy_from_user((void *)maddr, (const void *)uaddr, size,
+			       &trap)) {
+		ebi_warn("[copy_from_user] fault at 0x%lx, cause %ld\n",
+			 trap.tval, trap.cause);
+		return EBI_ERROR;
 	}
+	return EBI_OK;
+}
+
+/*
+ * copy_from_user() into enclave memory a page at a time, hashing each
+ * page while it is still in the cache. The payload is read through
+ * MPRV, so it cannot share the loads of the firmware side copies.
+ */
+#define MEASURE_CHUNK EPAGE_SIZE
+
+static uintptr_t copy_from_user_measured(uintptr_t uaddr, uintptr_t maddr,
+					 uintptr_t size, struct ebi_measure *m)
+{
+	uintptr_t len;
+
+	while (size) {
+		len = MIN(size, (uintptr_t)MEASURE_CHUNK);
+		if (copy_from_user(uaddr, maddr, len))
+			return EBI_ERROR;
+		ebi_measure_update(m, (void *)maddr, len);
+		uaddr += len;
+		maddr += len;
+		size -= len;
+	}
+	return EBI_OK;
 }
 
 uintptr_t find_avail_enclave()
 {
-	for (size_t i = 0; i < NUM_ENCLAVE; ++i) {
-		if (enclaves[i].status == ENC_FREE)
+	for (size_t i = 0; i < num_enclaves; ++i) {
+		spin_lock(&enclaves[i].lock);
+		if (enclaves[i].status == ENC_FREE) {
+			/* LOADED enclave, loaded not running */
+			enclaves[i].status = ENC_LOAD;
+			spin_unlock(&enclaves[i].lock);
 			return i;
+		}
+		spin_unlock(&enclaves[i].lock);
 	}
 	return EBI_ERROR;
 }
 
+static uintptr_t enclave_drv_mem_min(uintptr_t driver_bitmask);
+static void drv_queue_init(void);
+static void drvrelease_all(int enclave_id);
+
+/*
+ * The base module and driver images are flat binaries whose page tables
+ * and bss are stored as zeroes. Enclave memory is handed out zeroed, so
+ * only the pages of an image that hold something need copying. The runs
+ * of such pages are found once at boot.
+ */
+#define IMAGE_MAX_RUNS 4
+
+typedef struct {
+	uintptr_t off;
+	uintptr_t size;
+} image_run_t;
+
+typedef struct {
+	uintptr_t start;
+	uintptr_t size;
+	int nruns;
+	image_run_t runs[IMAGE_MAX_RUNS];
+} image_layout_t;
+
+static image_layout_t base_image;
+static image_layout_t drv_images[MAX_DRV];
+
+static bool image_zero(uintptr_t addr, uintptr_t size)
+{
+	const unsigned long *p = (const unsigned long *)addr;
+	const unsigned char *b;
+	uintptr_t i;
+
+	for (i = 0; i < size / sizeof(*p); i++) {
+		if (p[i])
+			return FALSE;
+	}
+	b = (const unsigned char *)&p[i];
+	for (i = 0; i < size % sizeof(*p); i++) {
+		if (b[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void image_scan(image_layout_t *img, uintptr_t start, uintptr_t end)
+{
+	uintptr_t off, len, copied = 0;
+	image_run_t *run = NULL;
+
+	img->start = start;
+	img->size  = end - start;
+	img->nruns = 0;
+	for (off = 0; off < img->size; off += EPAGE_SIZE) {
+		len = MIN((uintptr_t)EPAGE_SIZE, img->size - off);
+		if (image_zero(start + off, len))
+			continue;
+		if (run && run->off + run->size == off) {
+			run->size += len;
+		} else if (img->nruns < IMAGE_MAX_RUNS) {
+			run	  = &img->runs[img->nruns++];
+			run->off  = off;
+			run->size = len;
+		} else {
+			/* Out of runs, copy the zero gap along with it */
+			run->size = off + len - run->off;
+		}
+	}
+
+	for (int i = 0; i < img->nruns; i++)
+		copied += img->runs[i].size;
+	ebi_info("[EBI] image @ 0x%lx: copying 0x%lx of 0x%lx bytes\n", start,
+		 copied, img->size);
+}
+
+/*
+ * dst must be zeroed enclave memory of at least img->size bytes. The
+ * runs are hashed as they are copied and the zero gaps are hashed
+ * without being read.
+ */
+static void image_copy(const image_layout_t *img, uintptr_t dst,
+		       struct ebi_measure *m)
+{
+	uintptr_t off = 0;
+
+	for (int i = 0; i < img->nruns; i++) {
+		ebi_measure_zero(m, img->runs[i].off - off);
+		ebi_measure_copy(m, (void *)(dst + img->runs[i].off),
+				 (void *)(img->start + img->runs[i].off),
+				 img->runs[i].size);
+		off = img->runs[i].off + img->runs[i].size;
+	}
+	ebi_measure_zero(m, img->size - off);
+}
+
 void init_enclaves(void)
 {
+	size_t table_size;
+	enclave_context *host;
+
 	enclave_mem_init();
-	sbi_memset(enclaves, 0, sizeof(enclave_context) * NUM_ENCLAVE);
-	enclaves[NUM_ENCLAVE].status = ENC_RUN;
-	for (size_t i = 0; i < NUM_ENCLAVE; ++i)
+
+	host_context_offset = sbi_scratch_alloc_offset(sizeof(enclave_context));
+	if (!host_context_offset)
+		die("no scratch space for the host enclave context");
+	for (u32 i = 0; i <= sbi_scratch_last_hartid(); i++) {
+		if (!sbi_hartid_to_scratch(i))
+			continue;
+		host = sbi_scratch_offset_ptr(sbi_hartid_to_scratch(i),
+					      host_context_offset);
+		SPIN_LOCK_INIT(host->lock);
+		host->id     = EBI_HOST_ID;
+		host->status = ENC_RUN;
+	}
+
+	num_enclaves = ((uintptr_t)&_enclave_end - (uintptr_t)&_enclave_start) /
+		       (EUSR_MEM_MIN + enclave_drv_mem_min(0));
+	if (!num_enclaves)
+		num_enclaves = 1;
+	table_size = PAGE_UP(num_enclaves * sizeof(enclave_context));
+	enclaves   = (enclave_context *)emem_alloc(table_size);
+	if (!enclaves)
+		die("no memory for %lu enclave slots", num_enclaves);
+	sbi_memzero(enclaves, table_size);
+
+	/* The host keeps ASID 0, and must keep the printed range free */
+	asid_bits    = tlb_probe_asid_bits();
+	asid_enabled = num_enclaves < (1UL << asid_bits);
+	if (asid_enabled)
+		ebi_info("[EBI] %lu ASID bits, enclaves use ASIDs %lu-%lu\n",
+			 asid_bits, (1UL << asid_bits) - num_enclaves,
+			 (1UL << asid_bits) - 1);
+	else
+		ebi_info("[EBI] not enough ASIDs, fencing on every switch\n");
+
+	for (size_t i = 0; i < num_enclaves; ++i) {
+		SPIN_LOCK_INIT(enclaves[i].lock);
+		enclaves[i].id	   = i;
 		enclaves[i].status = ENC_FREE;
-	sbi_printf("[EBI] enclaves init successfully!");
+		enclaves[i].asid   = asid_enabled ? (1UL << asid_bits) - 1 - i : 0;
+		sbi_hartmask_set_all(&enclaves[i].tlb_stale);
+	}
+	ebi_info("[EBI] %lu enclave slots init successfully!\n",
+		 num_enclaves);
+
+	drv_queue_init();
+	image_scan(&base_image, (uintptr_t)&_base_start, (uintptr_t)&_base_end);
+	for (int i = 0; i < MAX_DRV; i++) {
+		if (bbl_addr_list[i].drv_start)
+			image_scan(&drv_images[i], bbl_addr_list[i].drv_start,
+				   bbl_addr_list[i].drv_end);
+	}
+
+	enclave_pool_init(EUSR_MEM_SIZE,
+			  MAX(EDRV_MEM_SIZE,
+			      enclave_drv_mem_min(EBI_POOL_DRV_MASK)));
+}
+
+/*
+ * Enclave memory layout, both regions sized by the caller:
+ *
+ *   pa                      user region (usr_size): payload, then USR pool
+ *   pa + usr_size           driver region (drv_size): base module, drivers,
+ *                           driver address list and boot info, user
+ *                           parameters, then DRV pool
+ *   pa + usr_size + drv_size
+ */
+static uintptr_t enclave_drv_mem_min(uintptr_t driver_bitmask)
+{
+	uintptr_t base_size = PAGE_UP((uintptr_t)&_base_end -
+				      (uintptr_t)&_base_start);
+
+	return base_size +
+	       PAGE_UP(drvsize(driver_bitmask) +
+		       MAX_DRV * sizeof(drv_addr_t) + sizeof(ebi_boot_info_t)) +
+	       EPARAM_SIZE + EDRV_MEM_MIN;
+}
+
+/*
+ * Fill the driver region of zeroed enclave memory at pa: base module,
+ * the drivers in driver_bitmask, their address list and the boot info.
+ */
+void enclave_layout(uintptr_t pa, uintptr_t usr_size, uintptr_t drv_size,
+		    uintptr_t driver_bitmask, enclave_layout_t *layout)
+{
+	uintptr_t base_module_start = pa + usr_size;
+	uintptr_t extra_module_size;
+
+	// base module copying
+	ebi_debug(
+		"[enclave_layout] copying base module: from 0x%lx copy to 0x%lx\n",
+		base_image.start, base_module_start);
+	ebi_measure_start(&layout->measure);
+	image_copy(&base_image, base_module_start, &layout->measure);
+
+	// extra modules copying according to the module list
+	ebi_debug("[enclave_layout] copying extra modules: bitmask: 0x%lx\n",
+		  driver_bitmask);
+	base_module_start += PAGE_UP(base_image.size);
+	extra_module_size =
+		drvcpy(&base_module_start, driver_bitmask, &layout->measure);
+
+	layout->drv_list   = base_module_start;
+	layout->boot_info  = base_module_start + extra_module_size;
+	layout->user_param = PAGE_UP(layout->boot_info + sizeof(ebi_boot_info_t));
+
+	ebi_boot_info_t *info = (ebi_boot_info_t *)layout->boot_info;
+	info->usr_mem_size    = usr_size;
+	info->drv_mem_size    = drv_size;
+	info->drv_free_start  = layout->user_param + EPARAM_SIZE;
+#ifdef EBI_SVNAPOT
+	info->flags = EBI_BOOT_SVNAPOT;
+#endif
 }
 
 uintptr_t create_enclave(const struct sbi_trap_regs *regs, uintptr_t mepc)
@@ -339,60 +689,71 @@ uintptr_t create_enclave(const struct sbi_trap_regs *regs, uintptr_t mepc)
 	payload_addr		 = regs->a0;
 	size_t payload_size	 = regs->a1;
 	uintptr_t driver_bitmask = regs->a2;
+	/* Zero selects the default layout */
+	uintptr_t usr_size = regs->a3 ? PAGE_UP(regs->a3) : EUSR_MEM_SIZE;
+	uintptr_t drv_size = regs->a4 ? PAGE_UP(regs->a4) : EDRV_MEM_SIZE;
+	enclave_layout_t layout;
+	uintptr_t pa;
 
-	sbi_printf("[create_enclave] user_payload_addr = 0x%lx\n",
-		   payload_addr);
+	ebi_debug("[create_enclave] user_payload_addr = 0x%lx\n",
+		  payload_addr);
 
-	if (PAGE_UP(payload_size) > EMEM_SIZE)
-		return EBI_ERROR;
-
-	sbi_printf("[create_enclave] log1\n");
+	usr_size = MAX(usr_size, PAGE_UP(payload_size) + EUSR_MEM_MIN);
+	drv_size = MAX(drv_size, enclave_drv_mem_min(driver_bitmask));
+	ebi_debug("[create_enclave] usr_size = 0x%lx, drv_size = 0x%lx\n",
+		  usr_size, drv_size);
 
 	enclave_context *context = NULL;
 	uintptr_t avail_id	 = find_avail_enclave();
 
 	if (avail_id == EBI_ERROR)
 		return EBI_ERROR;
-	/* LOADED enclave, loaded not running */
-	enclaves[avail_id].status = ENC_LOAD;
-	context			  = &enclaves[avail_id];
-	sbi_printf("[create_enclave] log2\n");
+	context = &enclaves[avail_id];
 
-	if (EBI_OK != enclave_mem_alloc(context, EMEM_SIZE))
+	if (enclave_pool_get(usr_size, drv_size, driver_bitmask, &pa,
+			     &layout)) {
+		context->pa	  = pa;
+		context->mem_size = usr_size + drv_size;
+	} else {
+		/* Prepared slots hold memory a cold create may need */
+		while (enclave_mem_alloc(context, usr_size + drv_size) !=
+		       EBI_OK) {
+			if (!enclave_pool_shrink()) {
+				spin_lock(&context->lock);
+				context->status = ENC_FREE;
+				spin_unlock(&context->lock);
+				return EBI_ERROR;
+			}
+		}
+		enclave_layout(context->pa, usr_size, drv_size, driver_bitmask,
+			       &layout);
+	}
+	context->usr_size  = usr_size;
+	context->owner	   = host_owner(csr_read(CSR_SATP));
+	context->drv_size  = drv_size;
+	context->ring_pa    = 0;
+	context->ring_size  = 0;
+	context->share_pa   = 0;
+	context->share_size = 0;
+
+	ebi_debug("[create_enclave] enclave pa = 0x%lx\n", context->pa);
+	if (copy_from_user_measured(payload_addr, context->pa, payload_size,
+				    &layout.measure)) {
+		enclave_mem_free(context, FALSE);
+		spin_lock(&context->lock);
+		context->status = ENC_FREE;
+		spin_unlock(&context->lock);
+		enclave_pool_kick();
 		return EBI_ERROR;
-	sbi_printf("[create_enclave] log3\n");
-
-	uintptr_t base_module_copy_start, base_module_copy_end;
-	base_module_copy_start = (uintptr_t)&_base_start;
-	base_module_copy_end   = (uintptr_t)&_base_end;
-	size_t base_module_size =
-		PAGE_UP(base_module_copy_end - base_module_copy_start);
-	uintptr_t base_module_start = context->pa + EUSR_MEM_SIZE;
-	uintptr_t extra_module_size = 0;
-
-	// base module copying
-	sbi_printf(
-		"[create_enclave] copying base module: from 0x%lx copy to 0x%lx\n",
-		base_module_copy_start, base_module_start);
-	sbi_memcpy((void *)base_module_start, (void *)base_module_copy_start,
-		   base_module_size);
-
-	// extra modules copying according to the module list
-	sbi_printf("[create_enclave] copying extra modules: bitmask: 0x%lx\n",
-		   driver_bitmask);
-	base_module_start += base_module_size;
-	if (driver_bitmask != 0)
-		extra_module_size = drvcpy(&base_module_start, driver_bitmask);
-	else
-		base_module_start = 0;
-	sbi_printf("[create_enclave] enclave pa = 0x%lx\n", context->pa);
-	memcpy_from_user(payload_addr, context->pa, payload_size, mepc);
+	}
+	ebi_measure_finish(&layout.measure, context->measurement);
 	init_csr_context(context);
 
 	context->enclave_binary_size = payload_size;
-	context->drv_list	     = base_module_start;
-	context->user_param	     = base_module_start + extra_module_size;
-	// args[0]			     = avail_id;
+	context->drv_list	     = layout.drv_list;
+	context->boot_info	     = layout.boot_info;
+	context->user_param	     = layout.user_param;
+	((ebi_boot_info_t *)context->boot_info)->asid = context->asid;
 	return avail_id;
 }
 
@@ -400,103 +761,330 @@ uintptr_t create_enclave(const struct sbi_trap_regs *regs, uintptr_t mepc)
 uintptr_t enter_enclave(struct sbi_trap_regs *regs, uintptr_t mepc)
 {
 	uintptr_t id	      = regs->a0;
-	enclave_context *into = &enclaves[id], *from = &enclaves[NUM_ENCLAVE];
+	enclave_context *into = get_enclave(id), *from = host_context();
 
-	sbi_printf("[enter_enclave] log1\n");
-	if (into->status != ENC_LOAD || from->status != ENC_RUN)
+	ebi_debug("[enter_enclave] log1\n");
+	if (!into || from->status != ENC_RUN)
 		return EBI_ERROR;
 
-	sbi_printf("[enter_enclave] log2\n");
-	memcpy_from_user(regs->a2, into->user_param, regs->a1, mepc);
+	ebi_debug("[enter_enclave] log2\n");
+	if (regs->a1 > EPARAM_SIZE)
+		return EBI_ERROR;
 
-	sbi_printf("[enter_enclave] log3\n");
+	spin_lock(&into->lock);
+	if (into->status != ENC_LOAD || !host_owns(into)) {
+		spin_unlock(&into->lock);
+		return EBI_ERROR;
+	}
+	into->status = ENC_RUN;
+	spin_unlock(&into->lock);
+
+	if (copy_from_user(regs->a2, into->user_param, regs->a1)) {
+		spin_lock(&into->lock);
+		into->status = ENC_LOAD;
+		spin_unlock(&into->lock);
+		return EBI_ERROR;
+	}
+
+	ebi_debug("[enter_enclave] log3\n");
 	pmp_switch(into);
 	save_umode_context(from, regs); // this line is not compatible !!!
 	save_csr_context(from, mepc, regs);
 	restore_csr_context(into, regs);
-	flush_tlb();
+	tlb_enter(into, from);
 
 	/* User parameter */
 	/* argc and argv */
 	regs->a4 = regs->a0;
 	regs->a5 = into->user_param;
 
-	sbi_printf("[enter_enclave] into->pa = 0x%lx\n", into->pa);
+	ebi_debug("[enter_enclave] into->pa = 0x%lx\n", into->pa);
 
 	regs->a0     = id;
 	regs->a1     = into->pa;
 	regs->a2     = into->enclave_binary_size;
 	regs->a3     = into->drv_list;
-	into->status = ENC_RUN;
+	regs->a6     = into->boot_info;
+	from->id     = id;
 	from->status = ENC_IDLE;
-	return regs->a0;
+	return EBI_OK;
 }
 
+/*
+ * A host buffer an enclave may be granted: page aligned, at most max
+ * bytes, clear of the firmware and every enclave, and the hart must have
+ * the PMP entries below pmp_top.
+ */
+static bool host_range_valid(uintptr_t pa, uintptr_t size, uintptr_t max,
+			     unsigned int pmp_top)
+{
+	if (!size || size > max || ((pa | size) & MASK(EPAGE_SHIFT)))
+		return FALSE;
+	if (pa + size < pa ||
+	    (pa < (uintptr_t)&_enclave_end && pa + size > FW_TEXT_START))
+		return FALSE;
+	if (sbi_hart_pmp_count(sbi_scratch_thishart_ptr()) < pmp_top) {
+		ebi_warn("[host_range_valid] not enough PMP entries\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * The calling host's enclave id, if it may still be set up before its
+ * first enter
+ */
+static enclave_context *lock_loaded_enclave(uintptr_t id)
+{
+	enclave_context *context = get_enclave(id), *host = host_context();
+
+	if (!context || host->status != ENC_RUN)
+		return NULL;
+	spin_lock(&context->lock);
+	if (context->status != ENC_LOAD || !host_owns(context)) {
+		spin_unlock(&context->lock);
+		return NULL;
+	}
+	return context;
+}
+
+/*
+ * Called by the host with a0 = id, a1 = PA and a2 = size of a page aligned
+ * buffer in its own memory, before the enclave is first entered. The
+ * enclave is granted that buffer by PMP and emodule_base maps it, so the
+ * two sides can pass calls through it without switching worlds. The
+ * firmware does not look inside the ring.
+ */
+uintptr_t attach_ring(const struct sbi_trap_regs *regs)
+{
+	uintptr_t id = regs->a0, pa = regs->a1, size = regs->a2;
+	enclave_context *context;
+	ebi_boot_info_t *info;
+
+	/* The ring takes PMP entries 6 and 7 */
+	if (!host_range_valid(pa, size, EBI_RING_MAX_SIZE, 8))
+		return EBI_ERROR;
+	context = lock_loaded_enclave(id);
+	if (!context)
+		return EBI_ERROR;
+	context->ring_pa   = pa;
+	context->ring_size = size;
+	info		   = (ebi_boot_info_t *)context->boot_info;
+	info->ring_pa	   = pa;
+	info->ring_size	   = size;
+	spin_unlock(&context->lock);
+
+	ebi_debug("[attach_ring] enclave %lu: ring 0x%lx, size 0x%lx\n", id, pa,
+		  size);
+	return EBI_OK;
+}
+
+/*
+ * Called by the host with a0 = id, a1 = PA and a2 = size of a page aligned
+ * buffer in its own memory, before the enclave is first entered. The
+ * buffer stays shared for the enclave's lifetime: emodule_base maps it
+ * into the payload, so inputs and results of any size pass through it
+ * instead of being copied by enter or squeezed into registers.
+ */
+uintptr_t share_window(const struct sbi_trap_regs *regs)
+{
+	uintptr_t id = regs->a0, pa = regs->a1, size = regs->a2;
+	enclave_context *context;
+	ebi_boot_info_t *info;
+
+	/* The window takes PMP entries 8 and 9 */
+	if (!host_range_valid(pa, size, EBI_SHARE_MAX_SIZE, 10))
+		return EBI_ERROR;
+	context = lock_loaded_enclave(id);
+	if (!context)
+		return EBI_ERROR;
+	context->share_pa   = pa;
+	context->share_size = size;
+	info		    = (ebi_boot_info_t *)context->boot_info;
+	info->share_pa	    = pa;
+	info->share_size    = size;
+	spin_unlock(&context->lock);
+
+	ebi_debug("[share_window] enclave %lu: window 0x%lx, size 0x%lx\n", id,
+		  pa, size);
+	return EBI_OK;
+}
+
+/*
+ * Called by the owning host with a0 = id and a1 = a buffer of
+ * EBI_DIGEST_SIZE bytes in its address space, which gets the SHA-256 of the enclave's base
+ * module, drivers and payload as they were loaded.
+ */
+uintptr_t measure_enclave(const struct sbi_trap_regs *regs)
+{
+	enclave_context *context = get_enclave(regs->a0), *host = host_context();
+	u8 digest[EBI_DIGEST_SIZE];
+	struct sbi_trap_info trap;
+
+	if (!context || host->status != ENC_RUN)
+		return EBI_ERROR;
+	spin_lock(&context->lock);
+	if (context->status == ENC_FREE || !host_owns(context)) {
+		spin_unlock(&context->lock);
+		return EBI_ERROR;
+	}
+	sbi_memcpy(digest, context->measurement, EBI_DIGEST_SIZE);
+	spin_unlock(&context->lock);
+
+	if (sbi_copy_to_user((void *)regs->a1, digest, EBI_DIGEST_SIZE,
+			     &trap)) {
+		ebi_warn("[measure_enclave] fault at 0x%lx, cause %ld\n",
+			 trap.tval, trap.cause);
+		return EBI_ERROR;
+	}
+	return EBI_OK;
+}
+
+/* Scrub and release a slot that no hart is running */
+static void destroy_enclave(enclave_context *context)
+{
+	drvrelease_all(context->id);
+	/* Scrubbed by other harts before anyone can allocate it again */
+	emem_free_dirty(context->pa, context->mem_size);
+
+	spin_lock(&context->lock);
+	/* The next enclave in this slot reuses its ASID */
+	sbi_hartmask_set_all(&context->tlb_stale);
+	context->status = ENC_FREE;
+	spin_unlock(&context->lock);
+
+	enclave_pool_kick();
+}
+
+/*
+ * Called by the enclave with a0 = id, a1 = return value for the host.
+ * The host may also call it on one of its paused or never entered
+ * enclaves to tear it down without switching into it, but only from the
+ * address space that created the enclave or that it last paused to.
+ */
 uintptr_t exit_enclave(struct sbi_trap_regs *regs)
 {
 	uintptr_t id = regs->a0, retval = regs->a1;
 
-	enclave_context *from = &(enclaves[id]), *into = &enclaves[NUM_ENCLAVE];
-	if (from->status != ENC_RUN || into->status != ENC_IDLE)
+	enclave_context *from = get_enclave(id), *into = host_context();
+	if (!from)
 		return EBI_ERROR;
 
-	sbi_memset((void *)from->pa, 0, EMEM_SIZE);
-	enclave_mem_free(from);
+	if (into->status == ENC_RUN) {
+		spin_lock(&from->lock);
+		/* Only the host that created it, or it last paused to */
+		if ((from->status != ENC_IDLE && from->status != ENC_LOAD) ||
+		    !host_owns(from)) {
+			spin_unlock(&from->lock);
+			return EBI_ERROR;
+		}
+		/* Nobody can enter or resume it any more */
+		from->status = ENC_RUN;
+		spin_unlock(&from->lock);
+		destroy_enclave(from);
+		regs->a0 = EBI_OK;
+		return EBI_OK;
+	}
+
+	/* Only the hart running an enclave may tear it down */
+	if (into->status != ENC_IDLE || into->id != id)
+		return EBI_ERROR;
+
+	spin_lock(&from->lock);
+	if (from->status != ENC_RUN) {
+		spin_unlock(&from->lock);
+		return EBI_ERROR;
+	}
+	spin_unlock(&from->lock);
+
+	destroy_enclave(from);
 	// clean and switch pmp
 	pmp_switch(NULL);
 	restore_umode_context(into, regs);
 	restore_csr_context(into, regs);
+	tlb_leave(from, into);
+
+	regs->a0     = retval;
+	into->id     = EBI_HOST_ID;
+	into->status = ENC_RUN;
+	return EBI_OK;
+}
+
+/*
+ * Called by the enclave with a0 = id, a1 = value for the host. The enclave
+ * keeps its memory and its whole register and CSR state, and goes back to
+ * the host as if its enter or resume call had returned a1. Drivers it
+ * holds are released, nobody would give them back while it is paused.
+ */
+uintptr_t pause_enclave(struct sbi_trap_regs *regs, uintptr_t mepc)
+{
+	uintptr_t id = regs->a0, retval = regs->a1;
+
+	enclave_context *from = get_enclave(id), *into = host_context();
+	/* ensure one can only pause itself */
+	if (!from || into->status != ENC_IDLE || into->id != id)
+		return EBI_ERROR;
+
+	spin_lock(&from->lock);
+	if (from->status != ENC_RUN) {
+		spin_unlock(&from->lock);
+		return EBI_ERROR;
+	}
+	spin_unlock(&from->lock);
+
+	drvrelease_all(id);
+	save_umode_context(from, regs);
+	save_csr_context(from, mepc, regs);
+	// protect entire enclave section
+	pmp_switch(NULL);
+	restore_umode_context(into, regs);
+	restore_csr_context(into, regs);
+	tlb_leave(from, into);
 
 	regs->a0 = retval;
 
-	from->status = ENC_FREE;
+	spin_lock(&from->lock);
+	from->status = ENC_IDLE;
+	from->owner  = host_owner(into->ns_satp);
+	spin_unlock(&from->lock);
+	into->id     = EBI_HOST_ID;
 	into->status = ENC_RUN;
 	return EBI_OK;
 }
-// TODO: actually pause/resume can replace enter/exit
-/* pause an enclave, do not take care of ret */
-uintptr_t pause_enclave(uintptr_t id, uintptr_t *regs, uintptr_t mepc)
-{
-	// enclave_context *from = &(enclaves[id]);
-	// // ensure one can only pause itself
-	// if (from->status != ENC_RUN)
-	// 	return EBI_ERROR;
-
-	// save_umode_context(from, regs);
-	// save_csr_context(from, mepc);
-	// // protect entire enclave section
-	// pmp_switch(NULL);
-	// /* Stop paging and save page table */
-	// csr_write(CSR_SATP, 0x0);
-	// flush_tlb();
-
-	// from->status = ENC_IDLE;
-	return 0;
-}
-/* resume certain enclave, must exist */
-uintptr_t resume_enclave(uintptr_t id, uintptr_t *regs)
-{
-	// enclave_context *into = &(enclaves[id]);
-	// if (into->status != ENC_IDLE && into->status != ENC_LOAD)
-	// 	return EBI_ERROR;
-
-	// pmp_switch(into);
-	// restore_csr_context(into);
-	// if (into->status == ENC_IDLE)
-	// 	restore_umode_context(into, regs);
-	// else {
-	// 	/* User parameter */
-	// 	regs[A4_INDEX] = regs[A1_INDEX];
-	// 	regs[A5_INDEX] = regs[A2_INDEX];
-
-	// 	regs[A0_INDEX] = id;
-	// 	regs[A1_INDEX] = into->pa;
-	// 	regs[A2_INDEX] = into->enclave_binary_size;
-	// 	regs[A3_INDEX] = into->drv_list;
-	// }
-	// into->status = ENC_RUN;
-	// return id;
-	return 0;
+
+/*
+ * Called by the host with a0 = id, a1 = value for the enclave. A paused
+ * enclave carries on from its pause call, which returns a1. Any hart may
+ * resume it, not only the one it paused on, but only from the address
+ * space it paused to.
+ */
+uintptr_t resume_enclave(struct sbi_trap_regs *regs, uintptr_t mepc)
+{
+	uintptr_t id = regs->a0, arg = regs->a1;
+
+	enclave_context *into = get_enclave(id), *from = host_context();
+	if (!into || from->status != ENC_RUN)
+		return EBI_ERROR;
+
+	spin_lock(&into->lock);
+	if (into->status != ENC_IDLE || !host_owns(into)) {
+		spin_unlock(&into->lock);
+		return EBI_ERROR;
+	}
+	into->status = ENC_RUN;
+	spin_unlock(&into->lock);
+
+	pmp_switch(into);
+	save_umode_context(from, regs);
+	save_csr_context(from, mepc, regs);
+	restore_umode_context(into, regs);
+	restore_csr_context(into, regs);
+	tlb_enter(into, from);
+
+	regs->a0     = arg;
+	from->id     = id;
+	from->status = ENC_IDLE;
+	return EBI_OK;
 }
 
 extern char _console_start, _console_end;
@@ -508,25 +1096,25 @@ drv_addr_t bbl_addr_list[MAX_DRV] = {
 
 // drv_addr_t bbl_addr_list[MAX_DRV] = {};
 
-uintptr_t drvcpy(uintptr_t *start_addr, uintptr_t bitmask)
+uintptr_t drvcpy(uintptr_t *start_addr, uintptr_t bitmask,
+		 struct ebi_measure *m)
 {
 	drv_addr_t drv_addr_list[64] = {};
 	int cnt			     = 0;
 	for (int i = 0; i < MAX_DRV; i++) {
-		if (bbl_addr_list[i].drv_start && (bitmask & (1 << i))) {
-			sbi_printf("[drvcpy] cnt = %d\n", cnt);
-			uintptr_t drv_start = bbl_addr_list[i].drv_start;
+		if (bbl_addr_list[i].drv_start && (bitmask & (1UL << i))) {
+			ebi_debug("[drvcpy] cnt = %d\n", cnt);
 			uintptr_t drv_size  = bbl_addr_list[i].drv_end -
 					     bbl_addr_list[i].drv_start;
 			drv_addr_list[cnt].drv_start = *start_addr;
 			drv_addr_list[cnt].drv_end   = *start_addr + drv_size;
-			sbi_printf(
+			drv_addr_list[cnt].id        = i;
+			ebi_debug(
 				"[drvcpy] drv %d: start = 0x%lx end = 0x%lx\n",
 				i, drv_addr_list[cnt].drv_start,
 				drv_addr_list[cnt].drv_end);
 			cnt++;
-			sbi_memcpy((void *)(*start_addr), (void *)drv_start,
-				   drv_size);
+			image_copy(&drv_images[i], *start_addr, m);
 			*start_addr += drv_size;
 		}
 	}
@@ -535,23 +1123,242 @@ uintptr_t drvcpy(uintptr_t *start_addr, uintptr_t bitmask)
 	return sizeof(drv_addr_list);
 }
 
-char drvfetch(int enclave_id, int driver_id)
+uintptr_t drvsize(uintptr_t bitmask)
+{
+	uintptr_t size = 0;
+	for (int i = 0; i < MAX_DRV; i++) {
+		if (bbl_addr_list[i].drv_start && (bitmask & (1UL << i)))
+			size += bbl_addr_list[i].drv_end -
+				bbl_addr_list[i].drv_start;
+	}
+	return size;
+}
+
+/*
+ * Ownership of a driver is a queued lock. A free driver is taken with one
+ * lock round trip; otherwise the calling hart links itself at the tail of
+ * the driver's wait queue and parks in WFI. Release hands the driver
+ * straight to the head of the queue and wakes that hart with an IPI, so
+ * waiters are served in arrival order and none of them spins in M-mode.
+ */
+#define DRV_NO_HART ((u32)-1)
+
+typedef struct {
+	int enclave_id;
+	u32 next;
+} drv_waiter_t;
+
+typedef struct {
+	spinlock_t lock;
+	u32 head, tail;
+	struct enclave_drv_stats stats;
+} drv_queue_t;
+
+/* A hart waits for at most one driver at a time */
+static drv_waiter_t drv_waiters[SBI_HARTMASK_MAX_BITS];
+static drv_queue_t drv_queues[MAX_DRV];
+static u32 drv_wake_event = SBI_IPI_EVENT_MAX;
+
+/* Nothing to do, the IPI only has to end the waiter's WFI */
+static void drv_wake_process(struct sbi_scratch *scratch)
+{
+}
+
+static struct sbi_ipi_event_ops drv_wake_ops = {
+	.name	 = "IPI_EBI_DRV",
+	.process = drv_wake_process,
+};
+
+static void drv_queue_init(void)
+{
+	int ret;
+
+	for (int i = 0; i < MAX_DRV; i++) {
+		SPIN_LOCK_INIT(drv_queues[i].lock);
+		drv_queues[i].head = drv_queues[i].tail = DRV_NO_HART;
+	}
+	ret = sbi_ipi_event_create(&drv_wake_ops);
+	if (ret < 0)
+		ebi_warn("[EBI] drv: no IPI event, waiters poll\n");
+	else
+		drv_wake_event = ret;
+}
+
+/* Unlink hartid from the wait queue, with the queue lock held */
+static void drv_queue_remove(drv_queue_t *q, u32 hartid)
+{
+	u32 prev = DRV_NO_HART, cur;
+
+	for (cur = q->head; cur != DRV_NO_HART; cur = drv_waiters[cur].next) {
+		if (cur == hartid)
+			break;
+		prev = cur;
+	}
+	if (cur == DRV_NO_HART)
+		return;
+	if (prev == DRV_NO_HART)
+		q->head = drv_waiters[cur].next;
+	else
+		drv_waiters[prev].next = drv_waiters[cur].next;
+	if (q->tail == cur)
+		q->tail = prev;
+}
+
+/* Hand the driver to the first waiter, or mark it free */
+static void drv_queue_handoff(drv_queue_t *q, drv_addr_t *drv)
 {
-	if (driver_id >= MAX_DRV)
-		return -1;
-	if (atomic_read((atomic_t *)&bbl_addr_list[driver_id].using_by) ==
-	    enclave_id)
-		return enclave_id;
-	while (atomic_cas(&bbl_addr_list[driver_id].using_by, -1, enclave_id) !=
-	       enclave_id)
-		;
-	return enclave_id;
+	u32 next = q->head;
+
+	if (next == DRV_NO_HART) {
+		atomic_swap(&drv->using_by, -1);
+		return;
+	}
+	q->head = drv_waiters[next].next;
+	if (q->head == DRV_NO_HART)
+		q->tail = DRV_NO_HART;
+	atomic_swap(&drv->using_by, drv_waiters[next].enclave_id);
+	q->stats.handoffs++;
+	if (drv_wake_event != SBI_IPI_EVENT_MAX)
+		sbi_ipi_send_many(1UL, next, drv_wake_event, NULL);
+}
+
+/*
+ * Sleep until an interrupt is pending, M-mode interrupts stay masked during
+ * the ecall. IPIs are processed here as the trap handler would. A timer
+ * interrupt is our own deadline or the host's event and is only masked:
+ * drvfetch() puts the host's compare value back, so the event is taken
+ * like any other host event that falls due while an enclave runs.
+ */
+static void drv_wait(void)
+{
+	unsigned long mip;
+
+	if (drv_wake_event != SBI_IPI_EVENT_MAX)
+		wfi();
+	mip = csr_read(CSR_MIP) & csr_read(CSR_MIE);
+	if (mip & MIP_MTIP)
+		csr_clear(CSR_MIE, MIP_MTIP);
+	if (mip & MIP_MSIP)
+		sbi_ipi_process();
+}
+
+/*
+ * Take driver_id for enclave_id, waiting at most timeout timer ticks for
+ * it. A timeout of 0, or one above EBI_DRV_FETCH_MAX_TICKS, waits that
+ * long. Taking a driver the enclave already owns succeeds straight away.
+ */
+int drvfetch(int enclave_id, int driver_id, u64 timeout)
+{
+	u32 hartid = current_hartid();
+	drv_addr_t *drv;
+	drv_queue_t *q;
+	u64 deadline, host_event, now, next;
+	int ret = EBI_OK;
+
+	if (driver_id < 0 || driver_id >= MAX_DRV ||
+	    !bbl_addr_list[driver_id].drv_start)
+		return EBI_ERROR;
+	drv = &bbl_addr_list[driver_id];
+	q   = &drv_queues[driver_id];
+
+	spin_lock(&q->lock);
+	if (drv->using_by == enclave_id) {
+		spin_unlock(&q->lock);
+		return EBI_OK;
+	}
+	q->stats.acquires++;
+	if (drv->using_by == -1) {
+		atomic_swap(&drv->using_by, enclave_id);
+		spin_unlock(&q->lock);
+		return EBI_OK;
+	}
+	q->stats.contended++;
+	drv_waiters[hartid].enclave_id = enclave_id;
+	drv_waiters[hartid].next       = DRV_NO_HART;
+	if (q->tail == DRV_NO_HART)
+		q->head = hartid;
+	else
+		drv_waiters[q->tail].next = hartid;
+	q->tail = hartid;
+	spin_unlock(&q->lock);
+
+	host_event = sbi_timer_get_event();
+	if (!timeout || timeout > EBI_DRV_FETCH_MAX_TICKS)
+		timeout = EBI_DRV_FETCH_MAX_TICKS;
+	deadline = sbi_timer_value() + timeout;
+
+	while (*(volatile int *)&drv->using_by != enclave_id) {
+		now = sbi_timer_value();
+		if (now >= deadline) {
+			spin_lock(&q->lock);
+			if (drv->using_by == enclave_id) {
+				spin_unlock(&q->lock);
+				break;
+			}
+			drv_queue_remove(q, hartid);
+			q->stats.timeouts++;
+			spin_unlock(&q->lock);
+			ret = EBI_ERROR;
+			break;
+		}
+		/* Wake up by the deadline, or the host's event if it is due first */
+		next = deadline;
+		if (host_event > now && host_event < next)
+			next = host_event;
+		sbi_timer_set_compare(next);
+		drv_wait();
+	}
+	sbi_timer_set_compare(host_event);
+	return ret;
 }
 
 void drvrelease(int enclave_id, int driver_id)
 {
-	if (driver_id >= MAX_DRV) {
+	drv_queue_t *q;
+
+	if (driver_id < 0 || driver_id >= MAX_DRV)
 		return;
+	q = &drv_queues[driver_id];
+	spin_lock(&q->lock);
+	if (bbl_addr_list[driver_id].using_by == enclave_id)
+		drv_queue_handoff(q, &bbl_addr_list[driver_id]);
+	spin_unlock(&q->lock);
+}
+
+/* Give back every driver a dying enclave still owns */
+static void drvrelease_all(int enclave_id)
+{
+	for (int i = 0; i < MAX_DRV; i++) {
+		if (bbl_addr_list[i].using_by == enclave_id)
+			drvrelease(enclave_id, i);
 	}
-	atomic_cas(&bbl_addr_list[driver_id].using_by, enclave_id, -1);
-}
\ No newline at end of file
+}
+
+void enclave_drv_get_stats(int driver_id, struct enclave_drv_stats *stats)
+{
+	drv_queue_t *q = &drv_queues[driver_id];
+
+	spin_lock(&q->lock);
+	*stats = q->stats;
+	spin_unlock(&q->lock);
+}
+
+/* The calling enclave takes the driver in a0, waiting up to a1 ticks */
+uintptr_t fetch_driver(const struct sbi_trap_regs *regs)
+{
+	enclave_context *host = host_context();
+
+	if (host->status != ENC_IDLE)
+		return EBI_ERROR;
+	return drvfetch(host->id, regs->a0, regs->a1);
+}
+
+uintptr_t release_driver(const struct sbi_trap_regs *regs)
+{
+	enclave_context *host = host_context();
+
+	if (host->status != ENC_IDLE)
+		return EBI_ERROR;
+	drvrelease(host->id, regs->a0);
+	return EBI_OK;
+}
@@ -0,0 +1,249 @@
+#include <sbi/sbi_ecall_ebi_measure.h>
+#include <sbi/riscv_encoding.h>
+#include <sbi/sbi_hart.h>
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
+
+static const u32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const u32 sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const u8 zero_block[EBI_SHA256_BLOCK];
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define BSWAP32(x)                                                      \
+	((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) |                  \
+	 (((x) >> 8) & 0xff00) | ((x) >> 24))
+
+/*
+ * Zknh sha256sum0/sum1/sig0/sig1, spelled with .insn so the assembler
+ * does not need to know the extension. imm selects the function.
+ */
+#define ZKNH_OP(x, imm)                                                  \
+	({                                                               \
+		unsigned long __r;                                       \
+		asm(".insn i 0x13, 1, %0, %1, " #imm                     \
+		    : "=r"(__r)                                          \
+		    : "r"((unsigned long)(x)));                          \
+		(u32) __r;                                               \
+	})
+
+/* zknh is a constant at every call site, so the other arm folds away */
+static inline __attribute__((always_inline)) u32 sum0(u32 x, bool zknh)
+{
+	return zknh ? ZKNH_OP(x, 0x100) : ROR32(x, 2) ^ ROR32(x, 13) ^ ROR32(x, 22);
+}
+
+static inline __attribute__((always_inline)) u32 sum1(u32 x, bool zknh)
+{
+	return zknh ? ZKNH_OP(x, 0x101) : ROR32(x, 6) ^ ROR32(x, 11) ^ ROR32(x, 25);
+}
+
+static inline __attribute__((always_inline)) u32 sig0(u32 x, bool zknh)
+{
+	return zknh ? ZKNH_OP(x, 0x102) : ROR32(x, 7) ^ ROR32(x, 18) ^ (x >> 3);
+}
+
+static inline __attribute__((always_inline)) u32 sig1(u32 x, bool zknh)
+{
+	return zknh ? ZKNH_OP(x, 0x103) : ROR32(x, 17) ^ ROR32(x, 19) ^ (x >> 10);
+}
+
+#define CH(e, f, g) ((g) ^ ((e) & ((f) ^ (g))))
+#define MAJ(a, b, c) (((a) & (b)) | ((c) & ((a) | (b))))
+
+/* One round, the message schedule kept in a 16 word window */
+#define ROUND(a, b, c, d, e, f, g, h, i, sched)                           \
+	do {                                                              \
+		if (sched)                                                \
+			w[(i) & 15] += sig1(w[((i) - 2) & 15], zknh) +   \
+				       w[((i) - 7) & 15] +               \
+				       sig0(w[((i) - 15) & 15], zknh);   \
+		t = h + sum1(e, zknh) + CH(e, f, g) + sha256_k[i] +       \
+		    w[(i) & 15];                                          \
+		d += t;                                                   \
+		h = t + sum0(a, zknh) + MAJ(a, b, c);                     \
+	} while (0)
+
+#define ROUND8(i, sched)                                          \
+	do {                                                      \
+		ROUND(a, b, c, d, e, f, g, h, (i) + 0, sched);    \
+		ROUND(h, a, b, c, d, e, f, g, (i) + 1, sched);    \
+		ROUND(g, h, a, b, c, d, e, f, (i) + 2, sched);    \
+		ROUND(f, g, h, a, b, c, d, e, (i) + 3, sched);    \
+		ROUND(e, f, g, h, a, b, c, d, (i) + 4, sched);    \
+		ROUND(d, e, f, g, h, a, b, c, (i) + 5, sched);    \
+		ROUND(c, d, e, f, g, h, a, b, (i) + 6, sched);    \
+		ROUND(b, c, d, e, f, g, h, a, (i) + 7, sched);    \
+	} while (0)
+
+static inline __attribute__((always_inline)) void
+sha256_compress(u32 *state, u32 *w, bool zknh)
+{
+	u32 a = state[0], b = state[1], c = state[2], d = state[3];
+	u32 e = state[4], f = state[5], g = state[6], h = state[7], t;
+	int i;
+
+	ROUND8(0, 0);
+	ROUND8(8, 0);
+	for (i = 16; i < 64; i += 8)
+		ROUND8(i, 1);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static void sha256_compress_base(u32 *state, u32 *w)
+{
+	sha256_compress(state, w, FALSE);
+}
+
+static void sha256_compress_zknh(u32 *state, u32 *w)
+{
+	sha256_compress(state, w, TRUE);
+}
+
+/*
+ * Read one block from src as big endian words and, if dst is given,
+ * write it there from the same loads. Aligned blocks move a doubleword
+ * at a time.
+ */
+static void sha256_block(struct ebi_measure *m, const u8 *src, u8 *dst)
+{
+	u32 w[16];
+	u64 v;
+	int i;
+
+	if (!(((uintptr_t)src | (uintptr_t)dst) & 7)) {
+		for (i = 0; i < 8; i++) {
+			v = ((const u64 *)src)[i];
+			if (dst)
+				((u64 *)dst)[i] = v;
+			w[2 * i]     = BSWAP32((u32)v);
+			w[2 * i + 1] = BSWAP32((u32)(v >> 32));
+		}
+	} else {
+		for (i = 0; i < 16; i++)
+			w[i] = (u32)src[4 * i] << 24 |
+			       (u32)src[4 * i + 1] << 16 |
+			       (u32)src[4 * i + 2] << 8 | src[4 * i + 3];
+		if (dst)
+			sbi_memcpy(dst, src, EBI_SHA256_BLOCK);
+	}
+
+	/* Measurements run on any hart, and harts may differ */
+	if (sbi_hart_has_feature(sbi_scratch_thishart_ptr(), SBI_HART_HAS_ZKNH))
+		sha256_compress_zknh(m->state, w);
+	else
+		sha256_compress_base(m->state, w);
+}
+
+void ebi_measure_start(struct ebi_measure *m)
+{
+	sbi_memcpy(m->state, sha256_iv, sizeof(sha256_iv));
+	m->len = 0;
+}
+
+/*
+ * Hash len bytes of src and copy them to dst unless dst is NULL. Whole
+ * blocks go straight from src; only the ends pass through m->buf.
+ */
+void ebi_measure_copy(struct ebi_measure *m, void *dst, const void *src,
+		      size_t len)
+{
+	const u8 *s = src;
+	u8 *d	    = dst;
+	size_t fill = m->len & (EBI_SHA256_BLOCK - 1), take;
+
+	m->len += len;
+	if (fill) {
+		take = MIN(EBI_SHA256_BLOCK - fill, len);
+		sbi_memcpy(m->buf + fill, s, take);
+		if (d) {
+			sbi_memcpy(d, s, take);
+			d += take;
+		}
+		s += take;
+		len -= take;
+		if (fill + take < EBI_SHA256_BLOCK)
+			return;
+		sha256_block(m, m->buf, NULL);
+	}
+
+	while (len >= EBI_SHA256_BLOCK) {
+		sha256_block(m, s, d);
+		s += EBI_SHA256_BLOCK;
+		if (d)
+			d += EBI_SHA256_BLOCK;
+		len -= EBI_SHA256_BLOCK;
+	}
+
+	if (len) {
+		sbi_memcpy(m->buf, s, len);
+		if (d)
+			sbi_memcpy(d, s, len);
+	}
+}
+
+void ebi_measure_update(struct ebi_measure *m, const void *data, size_t len)
+{
+	ebi_measure_copy(m, NULL, data, len);
+}
+
+/* Hash len zero bytes without reading them from anywhere but the cache */
+void ebi_measure_zero(struct ebi_measure *m, size_t len)
+{
+	size_t take;
+
+	while (len) {
+		take = MIN(len, (size_t)EBI_SHA256_BLOCK);
+		ebi_measure_update(m, zero_block, take);
+		len -= take;
+	}
+}
+
+void ebi_measure_finish(struct ebi_measure *m, u8 *digest)
+{
+	size_t fill = m->len & (EBI_SHA256_BLOCK - 1);
+	u64 bits    = m->len << 3;
+	int i;
+
+	m->buf[fill++] = 0x80;
+	if (fill > EBI_SHA256_BLOCK - 8) {
+		sbi_memset(m->buf + fill, 0, EBI_SHA256_BLOCK - fill);
+		sha256_block(m, m->buf, NULL);
+		fill = 0;
+	}
+	sbi_memset(m->buf + fill, 0, EBI_SHA256_BLOCK - 8 - fill);
+	for (i = 0; i < 8; i++)
+		m->buf[EBI_SHA256_BLOCK - 1 - i] = bits >> (8 * i);
+	sha256_block(m, m->buf, NULL);
+
+	for (i = 0; i < 8; i++) {
+		digest[4 * i]	  = m->state[i] >> 24;
+		digest[4 * i + 1] = m->state[i] >> 16;
+		digest[4 * i + 2] = m->state[i] >> 8;
+		digest[4 * i + 3] = m->state[i];
+	}
+}
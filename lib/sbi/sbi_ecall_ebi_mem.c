@@ -0,0 +1,418 @@
+#include <sbi/sbi_ecall_ebi_enclave.h>
+#include <sbi/sbi_ecall_ebi_mem.h>
+#include <sbi/riscv_locks.h>
+#include <sbi/sbi_console.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_ipi.h>
+#include <sbi/sbi_log.h>
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
+
+static struct emem_page emem_pages[EMEM_MAX_PAGE];
+static u16 emem_free_head[EMEM_MAX_ORDER + 1];
+static unsigned long emem_free_blocks[EMEM_MAX_ORDER + 1];
+static uintptr_t emem_base;
+static size_t emem_npages;
+static size_t emem_nfree;
+static spinlock_t emem_lock = SPIN_LOCK_INITIALIZER;
+
+/*
+ * Memory of torn down enclaves that still holds their data. It stays out
+ * of the free lists until it is zeroed, EMEM_SCRUB_CHUNK at a time, by
+ * whichever harts take the scrub IPI, so the exiting hart does not pay
+ * for it and the allocator only ever sees scrubbed extents.
+ */
+struct emem_extent {
+	uintptr_t pa;
+	size_t size;
+};
+
+static struct emem_extent emem_scrub_queue[EMEM_SCRUB_SLOTS];
+static unsigned int emem_scrub_count;
+/* Pages queued or being scrubbed right now */
+static size_t emem_scrub_pages;
+static spinlock_t emem_scrub_lock = SPIN_LOCK_INITIALIZER;
+static u32 emem_scrub_event	  = SBI_IPI_EVENT_MAX;
+
+static inline uintptr_t emem_idx_to_pa(size_t idx)
+{
+	return emem_base + (idx << EPAGE_SHIFT);
+}
+
+static inline size_t emem_pa_to_idx(uintptr_t pa)
+{
+	return (pa - emem_base) >> EPAGE_SHIFT;
+}
+
+static void emem_list_add(size_t idx, unsigned int order)
+{
+	struct emem_page *page = &emem_pages[idx];
+	u16 head	       = emem_free_head[order];
+
+	page->order = order;
+	page->flags |= EMEM_PAGE_FREE;
+	page->prev = EMEM_NIL;
+	page->next = head;
+	if (head != EMEM_NIL)
+		emem_pages[head].prev = idx;
+	emem_free_head[order] = idx;
+	emem_free_blocks[order]++;
+}
+
+static void emem_list_del(size_t idx)
+{
+	struct emem_page *page = &emem_pages[idx];
+
+	if (page->prev != EMEM_NIL)
+		emem_pages[page->prev].next = page->next;
+	else
+		emem_free_head[page->order] = page->next;
+	if (page->next != EMEM_NIL)
+		emem_pages[page->next].prev = page->prev;
+	page->flags &= ~EMEM_PAGE_FREE;
+	page->next = page->prev = EMEM_NIL;
+	emem_free_blocks[page->order]--;
+}
+
+/* Largest order such that a block at idx is aligned and fits in npages */
+static unsigned int emem_fit_order(size_t idx, size_t npages)
+{
+	unsigned int order = 0;
+
+	while (order < EMEM_MAX_ORDER && !(idx & (1UL << order)) &&
+	       (2UL << order) <= npages)
+		order++;
+	return order;
+}
+
+static unsigned int emem_size_order(size_t npages)
+{
+	unsigned int order = 0;
+
+	while ((1UL << order) < npages)
+		order++;
+	return order;
+}
+
+/* Free one aligned block and coalesce it with its buddies */
+static void emem_free_block(size_t idx, unsigned int order)
+{
+	size_t buddy;
+
+	while (order < EMEM_MAX_ORDER) {
+		buddy = idx ^ (1UL << order);
+		if (buddy + (1UL << order) > emem_npages)
+			break;
+		if (!(emem_pages[buddy].flags & EMEM_PAGE_FREE) ||
+		    emem_pages[buddy].order != order)
+			break;
+		emem_list_del(buddy);
+		idx &= ~(1UL << order);
+		order++;
+	}
+	emem_list_add(idx, order);
+}
+
+/* Free [idx, idx + npages) as a sequence of maximal aligned blocks */
+static void emem_free_range(size_t idx, size_t npages)
+{
+	unsigned int order;
+
+	while (npages) {
+		order = emem_fit_order(idx, npages);
+		emem_free_block(idx, order);
+		idx += 1UL << order;
+		npages -= 1UL << order;
+	}
+}
+
+int emem_init(uintptr_t base, size_t size)
+{
+	size_t i;
+
+	if ((base & MASK(EPAGE_SHIFT)) || (size & MASK(EPAGE_SHIFT)))
+		return SBI_EINVAL;
+	if ((size >> EPAGE_SHIFT) > EMEM_MAX_PAGE)
+		return SBI_EINVAL;
+
+	emem_base   = base;
+	emem_npages = size >> EPAGE_SHIFT;
+	emem_nfree  = 0;
+	for (i = 0; i <= EMEM_MAX_ORDER; i++) {
+		emem_free_head[i]   = EMEM_NIL;
+		emem_free_blocks[i] = 0;
+	}
+	for (i = 0; i < emem_npages; i++) {
+		emem_pages[i].next  = EMEM_NIL;
+		emem_pages[i].prev  = EMEM_NIL;
+		emem_pages[i].order = 0;
+		emem_pages[i].flags = 0;
+	}
+
+	emem_free_range(0, emem_npages);
+	emem_nfree = emem_npages;
+	return 0;
+}
+
+static uintptr_t __emem_alloc(size_t size)
+{
+	size_t npages = size >> EPAGE_SHIFT, idx, block;
+	unsigned int order, o;
+
+	if (!npages || (size & MASK(EPAGE_SHIFT)) || npages > emem_nfree)
+		return 0;
+
+	order = emem_size_order(npages);
+	if (order > EMEM_MAX_ORDER)
+		return 0;
+	for (o = order; o <= EMEM_MAX_ORDER; o++)
+		if (emem_free_head[o] != EMEM_NIL)
+			break;
+	if (o > EMEM_MAX_ORDER)
+		return 0;
+
+	idx = emem_free_head[o];
+	emem_list_del(idx);
+	/* Split down to the requested order, keeping the lower half */
+	while (o > order) {
+		o--;
+		emem_list_add(idx + (1UL << o), o);
+	}
+
+	block = 1UL << order;
+	if (block > npages)
+		emem_free_range(idx + npages, block - npages);
+
+	emem_nfree -= npages;
+	return emem_idx_to_pa(idx);
+}
+
+static void __emem_free(uintptr_t pa, size_t size, bool clean)
+{
+	size_t npages = size >> EPAGE_SHIFT, idx, i;
+
+	if (!npages || pa < emem_base ||
+	    emem_pa_to_idx(pa) + npages > emem_npages)
+		return;
+
+	idx = emem_pa_to_idx(pa);
+	for (i = idx; i < idx + npages; i++) {
+		if (clean)
+			emem_pages[i].flags |= EMEM_PAGE_CLEAN;
+		else
+			emem_pages[i].flags &= ~EMEM_PAGE_CLEAN;
+	}
+
+	emem_free_range(idx, npages);
+	emem_nfree += npages;
+}
+
+/* Take one chunk off the scrub queue and zero it, FALSE if none is left */
+static bool emem_scrub_chunk(void)
+{
+	struct emem_extent *ext;
+	uintptr_t pa;
+	size_t size;
+
+	spin_lock(&emem_scrub_lock);
+	if (!emem_scrub_count) {
+		spin_unlock(&emem_scrub_lock);
+		return FALSE;
+	}
+	ext  = &emem_scrub_queue[emem_scrub_count - 1];
+	pa   = ext->pa;
+	size = MIN(ext->size, (size_t)EMEM_SCRUB_CHUNK);
+	ext->pa += size;
+	ext->size -= size;
+	if (!ext->size)
+		emem_scrub_count--;
+	spin_unlock(&emem_scrub_lock);
+
+	sbi_memzero((void *)pa, size);
+	emem_free(pa, size, TRUE);
+
+	spin_lock(&emem_scrub_lock);
+	emem_scrub_pages -= size >> EPAGE_SHIFT;
+	spin_unlock(&emem_scrub_lock);
+	return TRUE;
+}
+
+static void emem_scrub_process(struct sbi_scratch *scratch)
+{
+	while (emem_scrub_chunk())
+		;
+}
+
+static struct sbi_ipi_event_ops emem_scrub_ops = {
+	.name	 = "IPI_EBI_SCRUB",
+	.process = emem_scrub_process,
+};
+
+void emem_scrub_init(void)
+{
+	int ret = sbi_ipi_event_create(&emem_scrub_ops);
+
+	if (ret < 0)
+		ebi_warn("[EBI] emem: no IPI event, scrubbing inline\n");
+	else
+		emem_scrub_event = ret;
+}
+
+/*
+ * Queue [pa, pa + size) for scrubbing and ask the harts whose host has
+ * suspended them to do it, never one that runs a host or an enclave.
+ * Without such a hart the range stays queued until emem_alloc() runs
+ * short and scrubs it. Without an IPI event or a free queue slot the
+ * range is scrubbed here.
+ */
+void emem_free_dirty(uintptr_t pa, size_t size)
+{
+	u32 hartid;
+	bool queued = FALSE;
+
+	spin_lock(&emem_scrub_lock);
+	if (emem_scrub_event != SBI_IPI_EVENT_MAX &&
+	    emem_scrub_count < EMEM_SCRUB_SLOTS) {
+		emem_scrub_queue[emem_scrub_count].pa	= pa;
+		emem_scrub_queue[emem_scrub_count].size = size;
+		emem_scrub_count++;
+		emem_scrub_pages += size >> EPAGE_SHIFT;
+		queued = TRUE;
+	}
+	spin_unlock(&emem_scrub_lock);
+
+	if (!queued) {
+		sbi_memzero((void *)pa, size);
+		emem_free(pa, size, TRUE);
+		return;
+	}
+
+	for (hartid = 0; hartid <= sbi_scratch_last_hartid(); hartid++) {
+		if (sbi_hartid_to_scratch(hartid) && enclave_hart_idle(hartid))
+			sbi_ipi_send_many(1UL, hartid, emem_scrub_event, NULL);
+	}
+}
+
+/*
+ * Allocate size bytes (page multiple) of physically contiguous memory.
+ * The request is served from the smallest free block of sufficient order
+ * and the unused tail of that block is given back straight away, so odd
+ * sized requests do not waste up to half of their block. If memory is
+ * short while some is still waiting to be scrubbed, the caller scrubs
+ * chunks itself until the request fits or nothing is left.
+ */
+uintptr_t emem_alloc(size_t size)
+{
+	uintptr_t pa;
+
+	for (;;) {
+		spin_lock(&emem_lock);
+		pa = __emem_alloc(size);
+		spin_unlock(&emem_lock);
+		if (pa || !emem_scrub_chunk())
+			return pa;
+	}
+}
+
+/*
+ * Give [pa, pa + size) back to the pool. Pass clean when the caller has
+ * already zeroed the range so the next allocation can skip it.
+ */
+void emem_free(uintptr_t pa, size_t size, bool clean)
+{
+	spin_lock(&emem_lock);
+	__emem_free(pa, size, clean);
+	spin_unlock(&emem_lock);
+}
+
+/*
+ * Zero the pages of an allocated range that are not known to be clean,
+ * one sbi_memzero per dirty run. The whole range is marked dirty again
+ * since its new owner is about to write to it. Returns the number of
+ * bytes actually cleared.
+ */
+size_t emem_zero(uintptr_t pa, size_t size)
+{
+	size_t idx = emem_pa_to_idx(pa), end = idx + (size >> EPAGE_SHIFT);
+	size_t run, zeroed = 0;
+
+	while (idx < end) {
+		if (emem_pages[idx].flags & EMEM_PAGE_CLEAN) {
+			emem_pages[idx++].flags &= ~EMEM_PAGE_CLEAN;
+			continue;
+		}
+		for (run = idx; run < end; run++) {
+			if (emem_pages[run].flags & EMEM_PAGE_CLEAN)
+				break;
+		}
+		sbi_memzero((void *)emem_idx_to_pa(idx),
+			    (run - idx) << EPAGE_SHIFT);
+		zeroed += (run - idx) << EPAGE_SHIFT;
+		idx = run;
+	}
+
+	return zeroed;
+}
+
+static unsigned long emem_nclean(void)
+{
+	unsigned long i, nclean = 0;
+	unsigned int o;
+	u16 idx;
+
+	for (o = 0; o <= EMEM_MAX_ORDER; o++) {
+		for (idx = emem_free_head[o]; idx != EMEM_NIL;
+		     idx = emem_pages[idx].next) {
+			for (i = idx; i < idx + (1UL << o); i++) {
+				if (emem_pages[i].flags & EMEM_PAGE_CLEAN)
+					nclean++;
+			}
+		}
+	}
+	return nclean;
+}
+
+void emem_get_stats(struct enclave_mem_stats *stats)
+{
+	unsigned int o;
+
+	spin_lock(&emem_lock);
+	stats->total_pages  = emem_npages;
+	stats->free_pages   = emem_nfree;
+	stats->largest_free = 0;
+	stats->free_blocks  = 0;
+	stats->clean_pages  = emem_nclean();
+	for (o = 0; o <= EMEM_MAX_ORDER; o++) {
+		stats->order_blocks[o] = emem_free_blocks[o];
+		stats->free_blocks += emem_free_blocks[o];
+		if (emem_free_blocks[o])
+			stats->largest_free = 1UL << o;
+	}
+	stats->frag_percent =
+		emem_nfree ? 100 - (stats->largest_free * 100) / emem_nfree
+			   : 0;
+	spin_unlock(&emem_lock);
+
+	spin_lock(&emem_scrub_lock);
+	stats->scrub_pages = emem_scrub_pages;
+	spin_unlock(&emem_scrub_lock);
+}
+
+void emem_dump_stats(void)
+{
+	struct enclave_mem_stats stats;
+	unsigned int o;
+
+	emem_get_stats(&stats);
+	ebi_info("[EBI] emem: %lu/%lu pages free, largest block %lu pages, "
+		 "%lu blocks, fragmentation %lu%%, %lu clean pages, "
+		 "%lu pages to scrub\n",
+		 stats.free_pages, stats.total_pages, stats.largest_free,
+		 stats.free_blocks, stats.frag_percent, stats.clean_pages,
+		 stats.scrub_pages);
+	for (o = 0; o <= EMEM_MAX_ORDER; o++) {
+		if (stats.order_blocks[o])
+			ebi_info("[EBI] emem:   order %2u: %lu\n", o,
+				 stats.order_blocks[o]);
+	}
+}
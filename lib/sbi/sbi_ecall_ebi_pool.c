@@ -0,0 +1,173 @@
+#include <sbi/sbi_ecall_ebi_pool.h>
+#include <sbi/sbi_ecall_ebi_mem.h>
+#include <sbi/riscv_asm.h>
+#include <sbi/riscv_locks.h>
+#include <sbi/sbi_ipi.h>
+#include <sbi/sbi_log.h>
+#include <sbi/sbi_scratch.h>
+
+typedef struct {
+	uintptr_t pa;
+	enclave_layout_t layout;
+} pool_entry_t;
+
+static pool_entry_t pool[EBI_POOL_SIZE ? EBI_POOL_SIZE : 1];
+static size_t pool_ready;
+/* Entries some hart is preparing right now */
+static size_t pool_busy;
+static uintptr_t pool_usr_size, pool_drv_size;
+static struct enclave_pool_stats pool_stats;
+static spinlock_t pool_lock = SPIN_LOCK_INITIALIZER;
+static u32 pool_event = SBI_IPI_EVENT_MAX;
+
+static bool pool_prepare(pool_entry_t *entry)
+{
+	uintptr_t size = pool_usr_size + pool_drv_size;
+
+	entry->pa = emem_alloc(size);
+	if (!entry->pa)
+		return FALSE;
+	emem_zero(entry->pa, size);
+	enclave_layout(entry->pa, pool_usr_size, pool_drv_size,
+		       EBI_POOL_DRV_MASK, &entry->layout);
+	return TRUE;
+}
+
+/* Prepare entries until the pool is full or memory runs out */
+static void pool_refill(void)
+{
+	pool_entry_t entry;
+	bool ok;
+
+	for (;;) {
+		spin_lock(&pool_lock);
+		if (pool_ready + pool_busy >= EBI_POOL_SIZE) {
+			spin_unlock(&pool_lock);
+			return;
+		}
+		pool_busy++;
+		spin_unlock(&pool_lock);
+
+		ok = pool_prepare(&entry);
+
+		spin_lock(&pool_lock);
+		pool_busy--;
+		if (ok) {
+			pool[pool_ready++] = entry;
+			pool_stats.refills++;
+		}
+		spin_unlock(&pool_lock);
+		if (!ok)
+			return;
+	}
+}
+
+static void pool_process(struct sbi_scratch *scratch)
+{
+	pool_refill();
+}
+
+static struct sbi_ipi_event_ops pool_ipi_ops = {
+	.name	 = "IPI_EBI_POOL",
+	.process = pool_process,
+};
+
+void enclave_pool_init(uintptr_t usr_size, uintptr_t drv_size)
+{
+	int ret;
+
+	pool_usr_size = usr_size;
+	pool_drv_size = drv_size;
+	if (!EBI_POOL_SIZE)
+		return;
+
+	ret = sbi_ipi_event_create(&pool_ipi_ops);
+	if (ret < 0)
+		ebi_warn("[EBI] pool: no IPI event, filled at boot only\n");
+	else
+		pool_event = ret;
+
+	pool_refill();
+	ebi_info("[EBI] pool: %lu of %d warm enclaves ready\n", pool_ready,
+		 EBI_POOL_SIZE);
+}
+
+/*
+ * Take a prepared entry if the request matches the layout the pool was
+ * built with. Counts a hit or a miss either way.
+ */
+bool enclave_pool_get(uintptr_t usr_size, uintptr_t drv_size,
+		      uintptr_t driver_bitmask, uintptr_t *pa,
+		      enclave_layout_t *layout)
+{
+	bool hit = FALSE;
+
+	spin_lock(&pool_lock);
+	if (pool_ready && usr_size == pool_usr_size &&
+	    drv_size == pool_drv_size && driver_bitmask == EBI_POOL_DRV_MASK) {
+		pool_ready--;
+		*pa	= pool[pool_ready].pa;
+		*layout = pool[pool_ready].layout;
+		hit	= TRUE;
+		pool_stats.hits++;
+	} else {
+		pool_stats.misses++;
+	}
+	spin_unlock(&pool_lock);
+
+	if (hit)
+		enclave_pool_kick();
+	return hit;
+}
+
+/* Give the memory of one prepared entry back, FALSE if there was none */
+bool enclave_pool_shrink(void)
+{
+	uintptr_t pa;
+
+	spin_lock(&pool_lock);
+	if (!pool_ready) {
+		spin_unlock(&pool_lock);
+		return FALSE;
+	}
+	pa = pool[--pool_ready].pa;
+	spin_unlock(&pool_lock);
+
+	emem_free(pa, pool_usr_size + pool_drv_size, FALSE);
+	return TRUE;
+}
+
+/*
+ * Ask for a refill if the pool is short. The work is only sent to a hart
+ * whose host has suspended it, never to one running Linux or an enclave,
+ * so neither pays for laying out images. Without such a hart the refill
+ * waits for the next kick.
+ */
+void enclave_pool_kick(void)
+{
+	u32 self = current_hartid(), hartid;
+	bool full;
+
+	spin_lock(&pool_lock);
+	full = pool_ready + pool_busy >= EBI_POOL_SIZE;
+	spin_unlock(&pool_lock);
+	if (full || pool_event == SBI_IPI_EVENT_MAX)
+		return;
+
+	for (u32 i = 1; i <= sbi_scratch_last_hartid(); i++) {
+		hartid = (self + i) % (sbi_scratch_last_hartid() + 1);
+		if (sbi_hartid_to_scratch(hartid) &&
+		    enclave_hart_idle(hartid)) {
+			sbi_ipi_send_many(1UL, hartid, pool_event, NULL);
+			return;
+		}
+	}
+}
+
+void enclave_pool_get_stats(struct enclave_pool_stats *stats)
+{
+	spin_lock(&pool_lock);
+	*stats	     = pool_stats;
+	stats->ready = pool_ready;
+	spin_unlock(&pool_lock);
+}
@@ -11,6 +11,7 @@
 #include <sbi/riscv_barrier.h>
 #include <sbi/riscv_encoding.h>
 #include <sbi/riscv_fp.h>
+#include <sbi/riscv_locks.h>
 #include <sbi/sbi_bitops.h>
 #include <sbi/sbi_console.h>
 #include <sbi/sbi_domain.h>
@@ -19,6 +20,7 @@
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_math.h>
 #include <sbi/sbi_platform.h>
+#include <sbi/sbi_rvv.h>
 #include <sbi/sbi_string.h>
 #include <sbi/sbi_trap.h>
 
@@ -34,6 +36,7 @@ struct hart_features {
 	unsigned long pmp_gran;
 	unsigned int mhpm_count;
 	unsigned int mhpm_bits;
+	unsigned long cboz_block_size;
 };
 static unsigned long hart_features_offset;
 
@@ -178,6 +181,18 @@ unsigned int sbi_hart_pmp_count(struct sbi_scratch *scratch)
 	return hfeatures->pmp_count;
 }
 
+/* Bytes zeroed by one cbo.zero, 0 if the hart has no Zicboz */
+unsigned long sbi_hart_cboz_block_size(struct sbi_scratch *scratch)
+{
+	struct hart_features *hfeatures;
+
+	/* Callers may zero memory before the features are known */
+	if (!hart_features_offset)
+		return 0;
+	hfeatures = sbi_scratch_offset_ptr(scratch, hart_features_offset);
+	return hfeatures->cboz_block_size;
+}
+
 unsigned long sbi_hart_pmp_granularity(struct sbi_scratch *scratch)
 {
 	struct hart_features *hfeatures =
@@ -293,6 +308,12 @@ static inline char *sbi_hart_feature_id2string(unsigned long feature)
 	case SBI_HART_HAS_TIME:
 		fstr = "time";
 		break;
+	case SBI_HART_HAS_ZICBOZ:
+		fstr = "zicboz";
+		break;
+	case SBI_HART_HAS_ZKNH:
+		fstr = "zknh";
+		break;
 	default:
 		break;
 	}
@@ -389,6 +410,75 @@ static int hart_pmu_get_allowed_bits(void)
 	return num_bits;
 }
 
+#define CBOZ_MAX_BLOCK 512
+
+static u8 cboz_probe_buf[CBOZ_MAX_BLOCK]
+	__attribute__((aligned(CBOZ_MAX_BLOCK)));
+static spinlock_t cboz_probe_lock = SPIN_LOCK_INITIALIZER;
+
+/*
+ * Run cbo.zero on a buffer of ones under the expected trap handler. The
+ * block size is not architecturally visible to M-mode, so it is taken
+ * from how many bytes the instruction cleared. Returns 0 without Zicboz.
+ */
+static unsigned long hart_detect_cboz(void)
+{
+	struct sbi_trap_info trap = { 0 };
+	register ulong tinfo asm("a3") = (ulong)&trap;
+	register ulong ttmp asm("a4");
+	register ulong mtvec = sbi_hart_expected_trap_addr();
+	unsigned long size = 0;
+
+	spin_lock(&cboz_probe_lock);
+	sbi_memset(cboz_probe_buf, 0xff, sizeof(cboz_probe_buf));
+	asm volatile("add %[ttmp], %[tinfo], zero\n"
+		     "csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"
+		     ".insn i 0x0f, 2, x0, %[buf], 4\n"
+		     "csrw " STR(CSR_MTVEC) ", %[mtvec]"
+		     : [mtvec] "+&r"(mtvec), [tinfo] "+&r"(tinfo),
+		       [ttmp] "+&r"(ttmp)
+		     : [buf] "r"(cboz_probe_buf)
+		     : "memory");
+	if (!trap.cause) {
+		while (size < sizeof(cboz_probe_buf) && !cboz_probe_buf[size])
+			size++;
+	}
+	spin_unlock(&cboz_probe_lock);
+
+	/* Only a power of two block is any use to sbi_memzero() */
+	return size & (size - 1) ? 0 : size;
+}
+
+#define ZKNH_PROBE_IN 0x12345678U
+#define ZKNH_PROBE_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * Run sha256sig0 under the expected trap handler. Without Zknh its
+ * encoding is a reserved SLLI that a core need not trap on, so the
+ * result is also checked against the base ISA sum.
+ */
+static bool hart_detect_zknh(void)
+{
+	struct sbi_trap_info trap = { 0 };
+	register ulong tinfo asm("a3") = (ulong)&trap;
+	register ulong ttmp asm("a4");
+	register ulong mtvec = sbi_hart_expected_trap_addr();
+	ulong out;
+
+	asm volatile("add %[ttmp], %[tinfo], zero\n"
+		     "csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"
+		     ".insn i 0x13, 1, %[out], %[in], 0x102\n"
+		     "csrw " STR(CSR_MTVEC) ", %[mtvec]"
+		     : [mtvec] "+&r"(mtvec), [tinfo] "+&r"(tinfo),
+		       [ttmp] "+&r"(ttmp), [out] "=&r"(out)
+		     : [in] "r"((ulong)ZKNH_PROBE_IN)
+		     : "memory");
+	return !trap.cause &&
+	       (u32)out == (ZKNH_PROBE_ROR(ZKNH_PROBE_IN, 7) ^
+			    ZKNH_PROBE_ROR(ZKNH_PROBE_IN, 18) ^
+			    (ZKNH_PROBE_IN >> 3));
+}
+
 static void hart_detect_features(struct sbi_scratch *scratch)
 {
 	struct sbi_trap_info trap = { 0 };
@@ -400,6 +490,7 @@ static void hart_detect_features(struct sbi_scratch *scratch)
 	hfeatures->features   = 0;
 	hfeatures->pmp_count  = 0;
 	hfeatures->mhpm_count = 0;
+	hfeatures->cboz_block_size = 0;
 
 #define __check_csr(__csr, __rdonly, __wrval, __field, __skip)           \
 	val = csr_read_allowed(__csr, (ulong)&trap);                     \
@@ -503,6 +594,15 @@ __mhpm_skip:
 	csr_read_allowed(CSR_TIME, (unsigned long)&trap);
 	if (!trap.cause)
 		hfeatures->features |= SBI_HART_HAS_TIME;
+
+	/* Detect if hart supports Zicboz and its cache block size */
+	hfeatures->cboz_block_size = hart_detect_cboz();
+	if (hfeatures->cboz_block_size)
+		hfeatures->features |= SBI_HART_HAS_ZICBOZ;
+
+	/* Detect if hart supports Zknh */
+	if (hart_detect_zknh())
+		hfeatures->features |= SBI_HART_HAS_ZKNH;
 }
 
 int sbi_hart_reinit(struct sbi_scratch *scratch)
@@ -528,6 +628,8 @@ int sbi_hart_init(struct sbi_scratch *scratch, bool cold_boot)
 		if (misa_extension('H'))
 			sbi_hart_expected_trap = &__sbi_expected_trap_hext;
 
+		sbi_rvv_init();
+
 		hart_features_offset =
 			sbi_scratch_alloc_offset(sizeof(struct hart_features));
 		if (!hart_features_offset)
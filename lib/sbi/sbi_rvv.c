@@ -0,0 +1,190 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * RVV 1.0 kernels for the firmware memory primitives.
+ *
+ * The rest of the firmware is built without V so the compiler never
+ * touches vector registers on its own; the instructions here are enabled
+ * per asm block with .option arch. The kernels work on e8 elements, copies
+ * and fills with LMUL 8 in v0-v7, compares with LMUL 4 in v0-v7 and the
+ * mask in v8, so at most v0-v8 need saving.
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/riscv_encoding.h>
+#include <sbi/sbi_rvv.h>
+#include <sbi/sbi_scratch.h>
+
+#ifdef FW_RVV
+
+#define RVV_ASM(insns) ".option push\n.option arch, +v\n" insns "\n.option pop"
+
+static bool rvv_enabled;
+/* Per hart save area, 0 if none could be had */
+static unsigned long rvv_save_offset;
+
+/* What has to be put back into the interrupted context's vector unit */
+struct rvv_state {
+	unsigned long vs;
+	unsigned long vstart, vcsr, vl, vtype;
+	u8 *regs;
+};
+
+void sbi_rvv_init(void)
+{
+	rvv_enabled = misa_extension('V');
+	if (rvv_enabled)
+		rvv_save_offset = sbi_scratch_alloc_offset(SBI_RVV_SAVE_MAX);
+}
+
+/* For the benchmark, returns whether the kernels were enabled before */
+bool sbi_rvv_set_enabled(bool enable)
+{
+	bool old = rvv_enabled;
+
+	rvv_enabled = enable && misa_extension('V');
+	return old;
+}
+
+/*
+ * Make the vector unit ours for a kernel over count bytes. Registers the
+ * interrupted context may still rely on (VS Initial, Clean or Dirty) are
+ * saved to this hart's scratch area; with VS Off there is nothing to keep.
+ * M-mode does not nest kernels, so one area per hart is enough. Returns
+ * FALSE if the vector path is not worth it or not possible.
+ */
+static bool rvv_begin(struct rvv_state *st, size_t count)
+{
+	unsigned long vlenb;
+	u8 *save;
+
+	if (!rvv_enabled)
+		return FALSE;
+	st->vs	 = csr_read(CSR_MSTATUS) & MSTATUS_VS;
+	st->regs = NULL;
+	if (!st->vs) {
+		csr_set(CSR_MSTATUS, MSTATUS_VS);
+		/* A stale vstart would make the kernels skip elements */
+		csr_write(CSR_VSTART, 0);
+		return TRUE;
+	}
+
+	vlenb = csr_read(CSR_VLENB);
+	if (count < SBI_RVV_MIN_SAVE_SIZE || !rvv_save_offset ||
+	    vlenb * 9 > SBI_RVV_SAVE_MAX)
+		return FALSE;
+	save	   = sbi_scratch_thishart_offset_ptr(rvv_save_offset);
+	st->vstart = csr_read(CSR_VSTART);
+	st->vcsr   = csr_read(CSR_VCSR);
+	st->vl	   = csr_read(CSR_VL);
+	st->vtype  = csr_read(CSR_VTYPE);
+	/* Whole register stores also start at vstart */
+	csr_write(CSR_VSTART, 0);
+	asm volatile(RVV_ASM("vs8r.v v0, (%0)") : : "r"(save) : "memory");
+	asm volatile(RVV_ASM("vs1r.v v8, (%0)")
+		     : : "r"(save + 8 * vlenb) : "memory");
+	st->regs = save;
+	return TRUE;
+}
+
+static void rvv_end(struct rvv_state *st)
+{
+	unsigned long vlenb;
+
+	if (st->regs) {
+		vlenb = csr_read(CSR_VLENB);
+		asm volatile(RVV_ASM("vl8re8.v v0, (%0)")
+			     : : "r"(st->regs) : "memory");
+		asm volatile(RVV_ASM("vl1re8.v v8, (%0)")
+			     : : "r"(st->regs + 8 * vlenb) : "memory");
+		asm volatile(RVV_ASM("vsetvl x0, %0, %1")
+			     : : "r"(st->vl), "r"(st->vtype));
+		csr_write(CSR_VSTART, st->vstart);
+		csr_write(CSR_VCSR, st->vcsr);
+	}
+	/* Leave VS as we found it, a Clean context stays Clean */
+	csr_clear(CSR_MSTATUS, MSTATUS_VS);
+	csr_set(CSR_MSTATUS, st->vs);
+}
+
+bool __sbi_rvv_memcpy(void *dest, const void *src, size_t count)
+{
+	const u8 *s = src;
+	u8 *d	    = dest;
+	struct rvv_state st;
+	size_t vl;
+
+	if (!rvv_begin(&st, count))
+		return FALSE;
+	while (count) {
+		asm volatile(RVV_ASM("vsetvli %0, %1, e8, m8, ta, ma\n"
+				     "vle8.v v0, (%2)\n"
+				     "vse8.v v0, (%3)")
+			     : "=&r"(vl)
+			     : "r"(count), "r"(s), "r"(d)
+			     : "memory");
+		s += vl;
+		d += vl;
+		count -= vl;
+	}
+	rvv_end(&st);
+	return TRUE;
+}
+
+bool __sbi_rvv_memset(void *s, int c, size_t count)
+{
+	struct rvv_state st;
+	u8 *d = s;
+	size_t vl;
+
+	if (!rvv_begin(&st, count))
+		return FALSE;
+	asm volatile(RVV_ASM("vsetvli %0, %1, e8, m8, ta, ma\n"
+			     "vmv.v.x v0, %2")
+		     : "=&r"(vl)
+		     : "r"(count), "r"((unsigned long)(u8)c));
+	while (count) {
+		asm volatile(RVV_ASM("vsetvli %0, %1, e8, m8, ta, ma\n"
+				     "vse8.v v0, (%2)")
+			     : "=&r"(vl)
+			     : "r"(count), "r"(d)
+			     : "memory");
+		d += vl;
+		count -= vl;
+	}
+	rvv_end(&st);
+	return TRUE;
+}
+
+bool __sbi_rvv_memcmp(const void *s1, const void *s2, size_t count,
+		      int *ret)
+{
+	const u8 *a = s1, *b = s2;
+	struct rvv_state st;
+	long first = -1;
+	size_t vl;
+
+	if (!rvv_begin(&st, count))
+		return FALSE;
+	while (count) {
+		asm volatile(RVV_ASM("vsetvli %0, %2, e8, m4, ta, ma\n"
+				     "vle8.v v0, (%3)\n"
+				     "vle8.v v4, (%4)\n"
+				     "vmsne.vv v8, v0, v4\n"
+				     "vfirst.m %1, v8")
+			     : "=&r"(vl), "=&r"(first)
+			     : "r"(count), "r"(a), "r"(b)
+			     : "memory");
+		if (first >= 0)
+			break;
+		a += vl;
+		b += vl;
+		count -= vl;
+	}
+	rvv_end(&st);
+
+	*ret = first >= 0 ? a[first] - b[first] : 0;
+	return TRUE;
+}
+
+#endif
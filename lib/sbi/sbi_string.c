@@ -8,10 +8,15 @@
  */
 
 /*
- * Simple libc functions. These are not optimized at all and might have some
- * bugs as well. Use any optimized routines from newlib or glibc if required.
+ * Simple libc functions. The string functions are not optimized at all and
+ * might have some bugs as well. Use any optimized routines from newlib or
+ * glibc if required.
  */
 
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_hart.h>
+#include <sbi/sbi_rvv.h>
+#include <sbi/sbi_scratch.h>
 #include <sbi/sbi_string.h>
 
 /*
@@ -106,22 +111,155 @@ char *sbi_strrchr(const char *s, int c)
 	else
 		return (char *)last;
 }
+/*
+ * The memory functions below move one machine word (64 bits on RV64, 32
+ * bits on RV32) per access and unroll the bulk loop eight times. Buffers
+ * that are not word aligned are handled with a byte head and tail; the
+ * firmware is built with -mstrict-align so no misaligned word access is
+ * ever issued.
+ */
+#define WORD_SIZE	sizeof(unsigned long)
+#define WORD_MASK	(WORD_SIZE - 1)
+#define BULK_SIZE	(8 * WORD_SIZE)
+
+static inline bool word_aligned(const void *p)
+{
+	return !((unsigned long)p & WORD_MASK);
+}
+
 void *sbi_memset(void *s, int c, size_t count)
 {
-	char *temp = s;
+	unsigned char *temp = s;
+	unsigned long *wtemp, word;
 
-	while (count > 0) {
+	if (sbi_rvv_memset(s, c, count))
+		return s;
+
+	while (count > 0 && !word_aligned(temp)) {
+		*temp++ = c;
 		count--;
+	}
+
+	if (count >= WORD_SIZE) {
+		word = (unsigned char)c;
+		word |= word << 8;
+		word |= word << 16;
+#if __riscv_xlen == 64
+		word |= word << 32;
+#endif
+		wtemp = (unsigned long *)temp;
+		for (; count >= BULK_SIZE; count -= BULK_SIZE, wtemp += 8) {
+			wtemp[0] = word;
+			wtemp[1] = word;
+			wtemp[2] = word;
+			wtemp[3] = word;
+			wtemp[4] = word;
+			wtemp[5] = word;
+			wtemp[6] = word;
+			wtemp[7] = word;
+		}
+		for (; count >= WORD_SIZE; count -= WORD_SIZE)
+			*wtemp++ = word;
+		temp = (unsigned char *)wtemp;
+	}
+
+	while (count > 0) {
 		*temp++ = c;
+		count--;
 	}
 
 	return s;
 }
 
+/*
+ * Zero count bytes. With Zicboz the cache block aligned middle of the
+ * buffer is cleared with one cbo.zero per block, which claims the line
+ * without reading it from memory; the ends go through sbi_memset().
+ */
+void *sbi_memzero(void *s, size_t count)
+{
+	unsigned long block =
+		sbi_hart_cboz_block_size(sbi_scratch_thishart_ptr());
+	unsigned long start = (unsigned long)s, end = start + count;
+	unsigned long first, last;
+
+	if (!block)
+		return sbi_memset(s, 0, count);
+	first = (start + block - 1) & ~(block - 1);
+	last  = end & ~(block - 1);
+	if (first >= last)
+		return sbi_memset(s, 0, count);
+
+	sbi_memset(s, 0, first - start);
+	for (; first < last; first += block)
+		cbo_zero(first);
+	sbi_memset((void *)last, 0, end - last);
+
+	return s;
+}
+
+/*
+ * Forward copy of count bytes where dest is word aligned and src is not.
+ * Source words are always read aligned and shifted into place, so no word
+ * is read that does not hold at least one byte of the source buffer.
+ */
+static void memcpy_shifted(unsigned long *dest, const unsigned char *src,
+			   size_t nwords)
+{
+	unsigned long off = (unsigned long)src & WORD_MASK;
+	const unsigned long *wsrc = (const unsigned long *)(src - off);
+	unsigned long lshift = off * 8, rshift = (WORD_SIZE - off) * 8;
+	unsigned long w0 = *wsrc++, w1;
+
+	while (nwords--) {
+		w1 = *wsrc++;
+		*dest++ = (w0 >> lshift) | (w1 << rshift);
+		w0 = w1;
+	}
+}
+
 void *sbi_memcpy(void *dest, const void *src, size_t count)
 {
-	char *temp1	  = dest;
-	const char *temp2 = src;
+	unsigned char *temp1	   = dest;
+	const unsigned char *temp2 = src;
+	unsigned long *wtemp1;
+	const unsigned long *wtemp2;
+	size_t nwords;
+
+	if (sbi_rvv_memcpy(dest, src, count))
+		return dest;
+
+	while (count > 0 && !word_aligned(temp1)) {
+		*temp1++ = *temp2++;
+		count--;
+	}
+
+	if (count >= WORD_SIZE && word_aligned(temp2)) {
+		wtemp1 = (unsigned long *)temp1;
+		wtemp2 = (const unsigned long *)temp2;
+		for (; count >= BULK_SIZE; count -= BULK_SIZE) {
+			wtemp1[0] = wtemp2[0];
+			wtemp1[1] = wtemp2[1];
+			wtemp1[2] = wtemp2[2];
+			wtemp1[3] = wtemp2[3];
+			wtemp1[4] = wtemp2[4];
+			wtemp1[5] = wtemp2[5];
+			wtemp1[6] = wtemp2[6];
+			wtemp1[7] = wtemp2[7];
+			wtemp1 += 8;
+			wtemp2 += 8;
+		}
+		for (; count >= WORD_SIZE; count -= WORD_SIZE)
+			*wtemp1++ = *wtemp2++;
+		temp1 = (unsigned char *)wtemp1;
+		temp2 = (const unsigned char *)wtemp2;
+	} else if (count >= WORD_SIZE) {
+		nwords = count / WORD_SIZE;
+		memcpy_shifted((unsigned long *)temp1, temp2, nwords);
+		temp1 += nwords * WORD_SIZE;
+		temp2 += nwords * WORD_SIZE;
+		count -= nwords * WORD_SIZE;
+	}
 
 	while (count > 0) {
 		*temp1++ = *temp2++;
@@ -133,25 +271,38 @@ void *sbi_memcpy(void *dest, const void *src, size_t count)
 
 void *sbi_memmove(void *dest, const void *src, size_t count)
 {
-	char *temp1	  = (char *)dest;
-	const char *temp2 = (char *)src;
+	unsigned char *temp1	   = dest;
+	const unsigned char *temp2 = src;
+	unsigned long *wtemp1;
+	const unsigned long *wtemp2;
 
 	if (src == dest)
 		return dest;
 
-	if (dest < src) {
-		while (count > 0) {
-			*temp1++ = *temp2++;
-			count--;
-		}
-	} else {
-		temp1 = dest + count - 1;
-		temp2 = src + count - 1;
+	/* A forward copy never overwrites source bytes it has yet to read */
+	if (dest < src || (const unsigned char *)src + count <= temp1)
+		return sbi_memcpy(dest, src, count);
+
+	temp1 += count;
+	temp2 += count;
 
-		while (count > 0) {
-			*temp1-- = *temp2--;
+	if (((unsigned long)temp1 & WORD_MASK) ==
+	    ((unsigned long)temp2 & WORD_MASK)) {
+		while (count > 0 && !word_aligned(temp1)) {
+			*--temp1 = *--temp2;
 			count--;
 		}
+		wtemp1 = (unsigned long *)temp1;
+		wtemp2 = (const unsigned long *)temp2;
+		for (; count >= WORD_SIZE; count -= WORD_SIZE)
+			*--wtemp1 = *--wtemp2;
+		temp1 = (unsigned char *)wtemp1;
+		temp2 = (const unsigned char *)wtemp2;
+	}
+
+	while (count > 0) {
+		*--temp1 = *--temp2;
+		count--;
 	}
 
 	return dest;
@@ -159,8 +310,33 @@ void *sbi_memmove(void *dest, const void *src, size_t count)
 
 int sbi_memcmp(const void *s1, const void *s2, size_t count)
 {
-	const char *temp1 = s1;
-	const char *temp2 = s2;
+	const unsigned char *temp1 = s1;
+	const unsigned char *temp2 = s2;
+	const unsigned long *wtemp1, *wtemp2;
+	int ret;
+
+	if (sbi_rvv_memcmp(s1, s2, count, &ret))
+		return ret;
+
+	if (((unsigned long)temp1 & WORD_MASK) ==
+	    ((unsigned long)temp2 & WORD_MASK)) {
+		for (; count > 0 && !word_aligned(temp1); count--) {
+			if (*temp1 != *temp2)
+				return *temp1 - *temp2;
+			temp1++;
+			temp2++;
+		}
+		/* Skip equal words, the byte loop locates the difference */
+		wtemp1 = (const unsigned long *)temp1;
+		wtemp2 = (const unsigned long *)temp2;
+		for (; count >= WORD_SIZE && *wtemp1 == *wtemp2;
+		     count -= WORD_SIZE) {
+			wtemp1++;
+			wtemp2++;
+		}
+		temp1 = (const unsigned char *)wtemp1;
+		temp2 = (const unsigned char *)wtemp2;
+	}
 
 	for (; count > 0 && (*temp1 == *temp2); count--) {
 		temp1++;
@@ -168,7 +344,7 @@ int sbi_memcmp(const void *s1, const void *s2, size_t count)
 	}
 
 	if (count > 0)
-		return *(unsigned char *)temp1 - *(unsigned char *)temp2;
+		return *temp1 - *temp2;
 	else
 		return 0;
 }
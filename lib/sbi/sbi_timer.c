@@ -17,6 +17,7 @@
 #include <sbi/sbi_timer.h>
 
 static unsigned long time_delta_off;
+static unsigned long next_event_off;
 static u64 (*get_time_val)(void);
 static const struct sbi_timer_device *timer_dev = NULL;
 
@@ -89,6 +90,10 @@ void sbi_timer_set_delta_upper(ulong delta_upper)
 
 void sbi_timer_event_start(u64 next_event)
 {
+	u64 *event = sbi_scratch_offset_ptr(sbi_scratch_thishart_ptr(),
+					    next_event_off);
+
+	*event = next_event;
 	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_SET_TIMER);
 	if (timer_dev && timer_dev->timer_event_start)
 		timer_dev->timer_event_start(next_event);
@@ -102,6 +107,25 @@ void sbi_timer_process(void)
 	csr_set(CSR_MIP, MIP_STIP);
 }
 
+u64 sbi_timer_get_event(void)
+{
+	u64 *event = sbi_scratch_offset_ptr(sbi_scratch_thishart_ptr(),
+					    next_event_off);
+
+	return (csr_read(CSR_MIE) & MIP_MTIP) ? *event : -1ULL;
+}
+
+void sbi_timer_set_compare(u64 value)
+{
+	if (value == -1ULL) {
+		csr_clear(CSR_MIE, MIP_MTIP);
+		return;
+	}
+	if (timer_dev && timer_dev->timer_event_start)
+		timer_dev->timer_event_start(value);
+	csr_set(CSR_MIE, MIP_MTIP);
+}
+
 const struct sbi_timer_device *sbi_timer_get_device(void)
 {
 	return timer_dev;
@@ -126,11 +150,14 @@ int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 		time_delta_off = sbi_scratch_alloc_offset(sizeof(*time_delta));
 		if (!time_delta_off)
 			return SBI_ENOMEM;
+		next_event_off = sbi_scratch_alloc_offset(sizeof(u64));
+		if (!next_event_off)
+			return SBI_ENOMEM;
 
 		if (sbi_hart_has_feature(scratch, SBI_HART_HAS_TIME))
 			get_time_val = get_ticks;
 	} else {
-		if (!time_delta_off)
+		if (!time_delta_off || !next_event_off)
 			return SBI_ENOMEM;
 	}
 
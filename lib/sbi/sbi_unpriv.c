@@ -7,10 +7,13 @@
  *   Anup Patel <anup.patel@wdc.com>
  */
 
+#include <sbi/riscv_asm.h>
 #include <sbi/riscv_encoding.h>
+#include <sbi/sbi_error.h>
 #include <sbi/sbi_bitops.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_unpriv.h>
 
@@ -163,3 +166,223 @@ ulong sbi_get_insn(ulong mepc, struct sbi_trap_info *trap)
 
 	return insn;
 }
+
+/* Words moved per MPRV window by the bulk user copies */
+#define UNPRIV_BATCH	8
+#define UNPRIV_WORD	sizeof(ulong)
+
+/*
+ * Load UNPRIV_BATCH words from user memory into dst. MPRV is only held
+ * across the eight loads; the values are written out to dst once it has
+ * been cleared again, since dst is not mapped for the lower mode.
+ */
+static void sbi_load_batch(ulong *dst, const ulong *src,
+			   struct sbi_trap_info *trap)
+{
+	register ulong tinfo asm("a3");
+	register ulong mstatus = 0;
+	register ulong mtvec = sbi_hart_expected_trap_addr();
+	ulong w0, w1, w2, w3, w4, w5, w6, w7;
+
+	trap->cause = 0;
+	asm volatile(
+		"add %[tinfo], %[taddr], zero\n"
+		"csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"
+		"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"
+		".option push\n"
+		".option norvc\n"
+		REG_L " %[w0], %[s0]\n"
+		REG_L " %[w1], %[s1]\n"
+		REG_L " %[w2], %[s2]\n"
+		REG_L " %[w3], %[s3]\n"
+		REG_L " %[w4], %[s4]\n"
+		REG_L " %[w5], %[s5]\n"
+		REG_L " %[w6], %[s6]\n"
+		REG_L " %[w7], %[s7]\n"
+		".option pop\n"
+		"csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"
+		"csrw " STR(CSR_MTVEC) ", %[mtvec]"
+	    : [mstatus] "+&r"(mstatus), [mtvec] "+&r"(mtvec),
+	      [tinfo] "+&r"(tinfo), [w0] "=&r"(w0), [w1] "=&r"(w1),
+	      [w2] "=&r"(w2), [w3] "=&r"(w3), [w4] "=&r"(w4),
+	      [w5] "=&r"(w5), [w6] "=&r"(w6), [w7] "=&r"(w7)
+	    : [s0] "m"(src[0]), [s1] "m"(src[1]), [s2] "m"(src[2]),
+	      [s3] "m"(src[3]), [s4] "m"(src[4]), [s5] "m"(src[5]),
+	      [s6] "m"(src[6]), [s7] "m"(src[7]),
+	      [mprv] "r"(MSTATUS_MPRV), [taddr] "r"((ulong)trap)
+	    : "a4", "memory");
+
+	dst[0] = w0;
+	dst[1] = w1;
+	dst[2] = w2;
+	dst[3] = w3;
+	dst[4] = w4;
+	dst[5] = w5;
+	dst[6] = w6;
+	dst[7] = w7;
+}
+
+/* Store UNPRIV_BATCH words from src to user memory under one MPRV window */
+static void sbi_store_batch(ulong *dst, const ulong *src,
+			    struct sbi_trap_info *trap)
+{
+	register ulong tinfo asm("a3");
+	register ulong mstatus = 0;
+	register ulong mtvec = sbi_hart_expected_trap_addr();
+	ulong w0 = src[0], w1 = src[1], w2 = src[2], w3 = src[3];
+	ulong w4 = src[4], w5 = src[5], w6 = src[6], w7 = src[7];
+
+	trap->cause = 0;
+	asm volatile(
+		"add %[tinfo], %[taddr], zero\n"
+		"csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"
+		"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"
+		".option push\n"
+		".option norvc\n"
+		REG_S " %[w0], %[d0]\n"
+		REG_S " %[w1], %[d1]\n"
+		REG_S " %[w2], %[d2]\n"
+		REG_S " %[w3], %[d3]\n"
+		REG_S " %[w4], %[d4]\n"
+		REG_S " %[w5], %[d5]\n"
+		REG_S " %[w6], %[d6]\n"
+		REG_S " %[w7], %[d7]\n"
+		".option pop\n"
+		"csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"
+		"csrw " STR(CSR_MTVEC) ", %[mtvec]"
+	    : [mstatus] "+&r"(mstatus), [mtvec] "+&r"(mtvec),
+	      [tinfo] "+&r"(tinfo)
+	    : [d0] "m"(dst[0]), [d1] "m"(dst[1]), [d2] "m"(dst[2]),
+	      [d3] "m"(dst[3]), [d4] "m"(dst[4]), [d5] "m"(dst[5]),
+	      [d6] "m"(dst[6]), [d7] "m"(dst[7]), [w0] "r"(w0),
+	      [w1] "r"(w1), [w2] "r"(w2), [w3] "r"(w3), [w4] "r"(w4),
+	      [w5] "r"(w5), [w6] "r"(w6), [w7] "r"(w7),
+	      [mprv] "r"(MSTATUS_MPRV), [taddr] "r"((ulong)trap)
+	    : "a4", "memory");
+}
+
+#if __riscv_xlen == 64
+#define sbi_store_ulong(addr, val, trap) \
+	sbi_store_u64((u64 *)(addr), val, trap)
+#else
+#define sbi_store_ulong(addr, val, trap) \
+	sbi_store_u32((u32 *)(addr), val, trap)
+#endif
+
+/**
+ * Copy size bytes from lower privilege virtual address src to dst.
+ *
+ * The user pointer is brought to word alignment with byte loads, then
+ * copied UNPRIV_BATCH words per MPRV window, then finished with single
+ * words and bytes. Faults are caught by the expected trap handler and
+ * reported through trap; dst is left partially written in that case.
+ */
+int sbi_copy_from_user(void *dst, const void *src, size_t size,
+		       struct sbi_trap_info *trap)
+{
+	ulong buf[UNPRIV_BATCH];
+	ulong uaddr = (ulong)src;
+	u8 *d = dst;
+
+	trap->cause = 0;
+	while (size && (uaddr & (UNPRIV_WORD - 1))) {
+		*d = sbi_load_u8((const u8 *)uaddr, trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		d++;
+		uaddr++;
+		size--;
+	}
+
+	while (size >= sizeof(buf)) {
+		if ((ulong)d & (UNPRIV_WORD - 1)) {
+			sbi_load_batch(buf, (const ulong *)uaddr, trap);
+			sbi_memcpy(d, buf, sizeof(buf));
+		} else {
+			sbi_load_batch((ulong *)d, (const ulong *)uaddr, trap);
+		}
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		d += sizeof(buf);
+		uaddr += sizeof(buf);
+		size -= sizeof(buf);
+	}
+
+	while (size >= UNPRIV_WORD) {
+		buf[0] = sbi_load_ulong((const ulong *)uaddr, trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		sbi_memcpy(d, buf, UNPRIV_WORD);
+		d += UNPRIV_WORD;
+		uaddr += UNPRIV_WORD;
+		size -= UNPRIV_WORD;
+	}
+
+	while (size) {
+		*d = sbi_load_u8((const u8 *)uaddr, trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		d++;
+		uaddr++;
+		size--;
+	}
+
+	return 0;
+}
+
+/**
+ * Copy size bytes from src to lower privilege virtual address dst.
+ * Same shape and fault reporting as sbi_copy_from_user().
+ */
+int sbi_copy_to_user(void *dst, const void *src, size_t size,
+		     struct sbi_trap_info *trap)
+{
+	ulong buf[UNPRIV_BATCH];
+	ulong uaddr = (ulong)dst;
+	const u8 *s = src;
+
+	trap->cause = 0;
+	while (size && (uaddr & (UNPRIV_WORD - 1))) {
+		sbi_store_u8((u8 *)uaddr, *s, trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		s++;
+		uaddr++;
+		size--;
+	}
+
+	while (size >= sizeof(buf)) {
+		if ((ulong)s & (UNPRIV_WORD - 1)) {
+			sbi_memcpy(buf, s, sizeof(buf));
+			sbi_store_batch((ulong *)uaddr, buf, trap);
+		} else {
+			sbi_store_batch((ulong *)uaddr, (const ulong *)s, trap);
+		}
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		s += sizeof(buf);
+		uaddr += sizeof(buf);
+		size -= sizeof(buf);
+	}
+
+	while (size >= UNPRIV_WORD) {
+		sbi_memcpy(buf, s, UNPRIV_WORD);
+		sbi_store_ulong(uaddr, buf[0], trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		s += UNPRIV_WORD;
+		uaddr += UNPRIV_WORD;
+		size -= UNPRIV_WORD;
+	}
+
+	while (size) {
+		sbi_store_u8((u8 *)uaddr, *s, trap);
+		if (trap->cause)
+			return SBI_EINVALID_ADDR;
+		s++;
+		uaddr++;
+		size--;
+	}
+
+	return 0;
+}